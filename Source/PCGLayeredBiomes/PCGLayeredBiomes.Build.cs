@@ -30,6 +30,7 @@ public class PCGLayeredBiomes : ModuleRules
 				"Engine",
 				"PCG",
 				"DeveloperSettings",
+				"NetCore",
 				// ... add other public dependencies that you statically link with here ...
 			}
 			);
@@ -0,0 +1,145 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include "Graph/LBPCGFilterRemovedInstances.h"
+
+#include "PCGComponent.h"
+#include "PCGContext.h"
+#include "PCGPin.h"
+#include "Data/PCGPointData.h"
+#include "Metadata/Accessors/PCGAttributeAccessorHelpers.h"
+#include "Runtime/LBBiomesInstanceController.h"
+
+#define LOCTEXT_NAMESPACE "PCGFilterRemovedInstancesSettings"
+
+ULBPCGFilterRemovedInstancesSettings::ULBPCGFilterRemovedInstancesSettings()
+{
+	MeshAttribute.SetAttributeName(TEXT("Mesh"));
+}
+
+TArray<FPCGPinProperties> ULBPCGFilterRemovedInstancesSettings::InputPinProperties() const
+{
+	TArray<FPCGPinProperties> Properties;
+	Properties.Emplace(PCGPinConstants::DefaultInputLabel, EPCGDataType::Point);
+	return Properties;
+}
+
+TArray<FPCGPinProperties> ULBPCGFilterRemovedInstancesSettings::OutputPinProperties() const
+{
+	TArray<FPCGPinProperties> Properties;
+	Properties.Emplace(PCGPinConstants::DefaultOutputLabel, EPCGDataType::Point);
+	return Properties;
+}
+
+FPCGElementPtr ULBPCGFilterRemovedInstancesSettings::CreateElement() const
+{
+	return MakeShared<FLBPCGFilterRemovedInstances>();
+}
+
+bool FLBPCGFilterRemovedInstances::ExecuteInternal(FPCGContext* Context) const
+{
+	const auto* Settings = Context->GetInputSettings<ULBPCGFilterRemovedInstancesSettings>();
+	check(Settings);
+
+	const auto Inputs = Context->InputData.GetInputsByPin(PCGPinConstants::DefaultInputLabel);
+	auto& Outputs = Context->OutputData.TaggedData;
+
+	const auto* SourceComponent = Context->SourceComponent.Get();
+	const auto* World = SourceComponent ? SourceComponent->GetWorld() : nullptr;
+	auto* Controller = World && World->IsGameWorld() ? ULBBiomesInstanceController::GetInstance(SourceComponent) : nullptr;
+	if (!Controller)
+	{
+		Outputs.Append(Inputs);
+		return true;
+	}
+
+	TMap<FSoftObjectPath, TBitArray<>> Removed;
+	Controller->PrefilterGeneration(SourceComponent, Settings, Removed);
+
+	// Original index of an instance is its ordinal number among points with the same mesh
+	TMap<FSoftObjectPath, int32> Ordinals;
+	TMap<FSoftObjectPath, int32> NumOutPoints;
+	TArray<FString> Meshes;
+	for (const auto& Input: Inputs)
+	{
+		const auto* InputData = Cast<UPCGPointData>(Input.Data);
+		if (!InputData)
+		{
+			PCGE_LOG(Error, GraphAndLog, LOCTEXT("InvalidInputData", "Invalid input data"));
+			continue;
+		}
+
+		const auto Selector = Settings->MeshAttribute.CopyAndFixLast(InputData);
+		const auto Accessor = PCGAttributeAccessorHelpers::CreateConstAccessor(InputData, Selector);
+		const auto Keys = PCGAttributeAccessorHelpers::CreateConstKeys(InputData, Selector);
+		
+		const auto& Points = InputData->GetPoints();
+		Meshes.SetNum(Points.Num());
+		if (!Accessor || !Keys || !Accessor->GetRange<FString>(Meshes, 0, *Keys, EPCGAttributeAccessorFlags::AllowBroadcast))
+		{
+			PCGE_LOG(Error, GraphAndLog, FText::Format(LOCTEXT("AttributeNotFound", "Mesh attribute '{0}' is not found"), Selector.GetDisplayText()));
+			Outputs.Add(Input);
+			continue;
+		}
+
+		if (Removed.IsEmpty())
+		{
+			for (const auto& Mesh: Meshes)
+			{
+				++NumOutPoints.FindOrAdd(FSoftObjectPath(Mesh));
+			}
+			Outputs.Add(Input);
+			continue;
+		}
+
+		auto* OutputData = NewObject<UPCGPointData>();
+		OutputData->InitializeFromData(InputData);
+		auto& OutPoints = OutputData->GetMutablePoints();
+		OutPoints.Reserve(Points.Num());
+		
+		for (int32 i = 0; i < Points.Num(); ++i)
+		{
+			const FSoftObjectPath Mesh(Meshes[i]);
+			const auto Ordinal = Ordinals.FindOrAdd(Mesh)++;
+			
+			const auto* RemovedOfMesh = Removed.Find(Mesh);
+			if (!RemovedOfMesh || !RemovedOfMesh->IsValidIndex(Ordinal) || !(*RemovedOfMesh)[Ordinal])
+			{
+				OutPoints.Add(Points[i]);
+				++NumOutPoints.FindOrAdd(Mesh);
+			}
+		}
+
+		auto& Output = Outputs.Add_GetRef(Input);
+		Output.Data = OutputData;
+	}
+
+	// Controller learns which meshes can be prefiltered by this node in the next generation
+	Controller->ReportFilteredMeshes(SourceComponent, Settings, NumOutPoints);
+
+	return true;
+}
+
+#undef LOCTEXT_NAMESPACE
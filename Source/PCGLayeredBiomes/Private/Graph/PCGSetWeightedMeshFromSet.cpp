@@ -33,6 +33,7 @@
 #include "LBBiomesSpawnManager.h"
 #include "LBRandomUtils.h"
 #include "Data/PCGPointData.h"
+#include "Engine/StreamableManager.h"
 #include "Helpers/PCGAsync.h"
 #include "Helpers/PCGDynamicTrackingHelpers.h"
 #include "Helpers/PCGHelpers.h"
@@ -62,6 +63,15 @@ FPCGElementPtr ULBPCGMeshFromSpawnManagerSettings::CreateElement() const
 	return MakeShared<FLBPCGMeshFromSpawnManager>();
 }
 
+FLBPCGMeshFromSpawnManagerContext::~FLBPCGMeshFromSpawnManagerContext()
+{
+	// Generation could be cancelled while meshes are loading - ensure callback will not touch destroyed context
+	if (LoadHandle)
+	{
+		LoadHandle->CancelHandle();
+	}
+}
+
 namespace PCGMeshSet
 {
 	struct FSharedParams
@@ -146,8 +156,15 @@ namespace PCGMeshSet
 
 				Results.Values[WriteIndex] = Info.Mesh.ToString();
 
-				if (ApplyBounds && Info.Mesh)
+				if (ApplyBounds && Info.MeshBounds.IsValid)
 				{
+					// Use bounds cached in the preset, so the mesh doesn't need to be loaded 
+					Results.BoundsMin[WriteIndex] = Info.MeshBounds.Min;
+					Results.BoundsMax[WriteIndex] = Info.MeshBounds.Max;
+				}
+				else if (ApplyBounds && Info.Mesh.IsValid())
+				{
+					// Preset wasn't resaved yet, fallback to already loaded mesh 
 					const auto Bounds = Info.Mesh->GetBounds();
 					Results.BoundsMin[WriteIndex] = Bounds.GetBox().Min;
 					Results.BoundsMax[WriteIndex] = Bounds.GetBox().Max;
@@ -178,10 +195,23 @@ namespace PCGMeshSet
 	}
 }
 
-bool FLBPCGMeshFromSpawnManager::ExecuteInternal(FPCGContext* Context) const
+FPCGContext* FLBPCGMeshFromSpawnManager::Initialize(const FPCGDataCollection& InputData,
+	TWeakObjectPtr<UPCGComponent> SourceComponent, const UPCGNode* Node)
+{
+	auto* Context = new FLBPCGMeshFromSpawnManagerContext();
+	Context->InputData = InputData;
+	Context->SourceComponent = SourceComponent;
+	Context->Node = Node;
+
+	return Context;
+}
+
+bool FLBPCGMeshFromSpawnManager::ExecuteInternal(FPCGContext* InContext) const
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE(FPCGNoise::Execute);
 
+	auto* Context = static_cast<FLBPCGMeshFromSpawnManagerContext*>(InContext);
+
 	const auto* Settings = Context->GetInputSettings<ULBPCGMeshFromSpawnManagerSettings>();
 	check(Settings);
 
@@ -194,7 +224,7 @@ bool FLBPCGMeshFromSpawnManager::ExecuteInternal(FPCGContext* Context) const
 		return true;
 	}
 	
-	const auto* Manager = ULBBiomesSpawnManager::GetManager(Context->SourceComponent.Get()); 
+	auto* Manager = ULBBiomesSpawnManager::GetManager(Context->SourceComponent.Get()); 
 	if (!Manager)
 	{
 		PCGE_LOG(Error, GraphAndLog, LOCTEXT("NoActorsManager", "Source Actor has no ULBBiomesSpawnManager component"));
@@ -225,6 +255,24 @@ bool FLBPCGMeshFromSpawnManager::ExecuteInternal(FPCGContext* Context) const
 		PCGE_LOG(Warning, GraphAndLog, LOCTEXT("WrongWeights", "All meshes in set has 0 weight - it's not supported"));
 		return true;
 	}
+
+	// Stream in meshes of the set before spawners will need them, so they don't block on synchronous loads
+	if (!Context->LoadRequested)
+	{
+		Context->LoadRequested = true;
+		Context->LoadHandle = Manager->PrefetchSet(Settings->SetName);
+
+		if (Context->LoadHandle && !Context->LoadHandle->HasLoadCompleted())
+		{
+			// Sleep until meshes are loaded, handle is cancelled together with the context
+			Context->bIsPaused = true;
+			Context->LoadHandle->BindCompleteDelegate(FStreamableDelegate::CreateLambda([Context]()
+			{
+				Context->bIsPaused = false;
+			}));
+			return false;
+		}
+	}
 	
 	TArray<FPCGTaggedData> Inputs = Context->InputData.GetInputsByPin(PCGPinConstants::DefaultInputLabel);	
 	for (const FPCGTaggedData& Input : Inputs)
@@ -31,6 +31,91 @@
 #include "Runtime/LBBiomesInstanceController.h"
 #include "Runtime/LBBiomesInstanceTracker.h"
 
+namespace LBBiomesComponentNames
+{
+	// Append-only, zero index is NAME_None
+	FRWLock Lock;
+	TArray<FName> Names = {NAME_None};
+	TMap<FName, int32> Indices = {{NAME_None, 0}};
+
+	int32 FindOrAdd(FName Name)
+	{
+		{
+			FReadScopeLock ReadLock(Lock);
+			if (const auto* Index = Indices.Find(Name))
+			{
+				return *Index;
+			}
+		}
+
+		FWriteScopeLock WriteLock(Lock);
+		if (const auto* Index = Indices.Find(Name))
+		{
+			return *Index;
+		}
+		if (Names.Num() >= FLBBiomesPackedInstanceHandle::MaxComponents)
+		{
+			return INDEX_NONE;
+		}
+		const int32 Index = Names.Add(Name);
+		Indices.Add(Name, Index);
+		return Index;
+	}
+
+	FName Get(int32 Index)
+	{
+		FReadScopeLock ReadLock(Lock);
+		return Names.IsValidIndex(Index) ? Names[Index] : NAME_None;
+	}
+}
+
+FLBBiomesPackedInstanceHandle FLBBiomesInstanceHandle::Pack() const
+{
+	return IsValid() ? FLBBiomesPackedInstanceHandle(GroupId, ComponentName, InstanceId) : FLBBiomesPackedInstanceHandle();
+}
+
+FLBBiomesPackedInstanceHandle::FLBBiomesPackedInstanceHandle(int32 GroupId, FName ComponentName, int32 InstanceId)
+{
+	if (GroupId == 0 || FMath::Abs(GroupId) > MaxGroupId || InstanceId < 0 || InstanceId > MaxInstanceId)
+	{
+		return;
+	}
+
+	const int32 ComponentIndex = LBBiomesComponentNames::FindOrAdd(ComponentName);
+	if (!ensureMsgf(ComponentIndex > 0, TEXT("Too many names of biome components to pack a handle")))
+	{
+		return;
+	}
+
+	constexpr uint64 GroupMask = (uint64(1) << GroupBits) - 1;
+	Value = ((static_cast<uint64>(GroupId) & GroupMask) << (ComponentBits + InstanceBits))
+		| (static_cast<uint64>(ComponentIndex) << InstanceBits)
+		| static_cast<uint64>(InstanceId);
+}
+
+int32 FLBBiomesPackedInstanceHandle::GetGroupId() const
+{
+	// Sign extension of the top bits
+	return static_cast<int32>(static_cast<int64>(Value) >> (ComponentBits + InstanceBits));
+}
+
+FName FLBBiomesPackedInstanceHandle::GetComponentName() const
+{
+	return LBBiomesComponentNames::Get(static_cast<int32>((Value >> InstanceBits) & (MaxComponents - 1)));
+}
+
+FLBBiomesInstanceHandle FLBBiomesPackedInstanceHandle::Unpack() const
+{
+	FLBBiomesInstanceHandle Handle;
+	if (IsValid())
+	{
+		Handle.GroupId = GetGroupId();
+		Handle.ComponentName = GetComponentName();
+		Handle.InstanceId = GetInstanceId();
+	}
+	return Handle;
+}
+
 template <typename AttributeType>
 static bool GetAttribute(const FPCGPoint& Point, const UPCGMetadata* Metadata, FName AttributeName, AttributeType& Value)
 {
@@ -82,6 +167,38 @@ bool ULBBiomesPCGUtils::RemoveInstance(UInstancedStaticMeshComponent* Component,
 	return {};
 }
 
+TArray<FLBBiomesInstanceHandle> ULBBiomesPCGUtils::RemoveInstances(UInstancedStaticMeshComponent* Component,
+	const TArray<int32>& InstanceIds)
+{
+	check(Component);
+	
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(Component))
+	{
+		return Controller->RemoveInstances(Component, InstanceIds);
+	}
+	return {};
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesPCGUtils::RemoveInstancesInBox(const FBox& Box)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		return Controller->RemoveInstancesInBox(Box);
+	}
+	return {};
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesPCGUtils::RemoveInstancesInSphere(const FVector& Center, float Radius)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		return Controller->RemoveInstancesInSphere(Center, Radius);
+	}
+	return {};
+}
+
 bool ULBBiomesPCGUtils::RestoreInstance(const FLBBiomesInstanceHandle& InstanceHandle)
 {
 	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
@@ -92,6 +209,91 @@ bool ULBBiomesPCGUtils::RestoreInstance(const FLBBiomesInstanceHandle& InstanceH
 	return false;
 }
 
+FLBBiomesInstanceHandle ULBBiomesPCGUtils::RemoveInstanceWithRegrowth(UInstancedStaticMeshComponent* Component, int32 InstanceId)
+{
+	check(Component);
+	
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(Component))
+	{
+		return Controller->RemoveInstanceWithRegrowth(Component, InstanceId);
+	}
+	return {};
+}
+
+void ULBBiomesPCGUtils::ScheduleRegrowth(const FLBBiomesInstanceHandle& InstanceHandle, float Delay)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		Controller->ScheduleRegrowth(InstanceHandle, Delay);
+	}
+}
+
+void ULBBiomesPCGUtils::CancelRegrowth(const FLBBiomesInstanceHandle& InstanceHandle)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		Controller->CancelRegrowth(InstanceHandle);
+	}
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesPCGUtils::FindRemovedInstancesInBox(const FBox& Box)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (const auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		return Controller->FindRemovedInstancesInBox(Box);
+	}
+	return {};
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesPCGUtils::FindRemovedInstancesInSphere(const FVector& Center, float Radius)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (const auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		return Controller->FindRemovedInstancesInSphere(Center, Radius);
+	}
+	return {};
+}
+
+TArray<FLBBiomesInstanceQueryResult> ULBBiomesPCGUtils::FindInstancesInSphere(const FVector& Center, float Radius,
+	const FLBBiomesInstanceFilter& Filter)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		return Controller->FindInstancesInSphere(Center, Radius, Filter);
+	}
+	return {};
+}
+
+TArray<FLBBiomesInstanceQueryResult> ULBBiomesPCGUtils::FindNearestInstances(const FVector& Location, int32 Count, float MaxDistance,
+	const FLBBiomesInstanceFilter& Filter)
+{
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		return Controller->FindNearestInstances(Location, Count, MaxDistance, Filter);
+	}
+	return {};
+}
+
+bool ULBBiomesPCGUtils::ResolveInstance(const FLBBiomesInstanceHandle& InstanceHandle, UInstancedStaticMeshComponent*& Component,
+	int32& InstanceId)
+{
+	Component = nullptr;
+	InstanceId = INDEX_NONE;
+	
+	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(WorldContext))
+	{
+		Component = Controller->ResolveInstance(InstanceHandle, InstanceId);
+	}
+	return Component != nullptr;
+}
+
 bool ULBBiomesPCGUtils::GetTransformByHandle(const FLBBiomesInstanceHandle& InstanceHandle, FTransform& InstanceTransform)
 {
 	const auto* WorldContext = UPCGSubsystem::GetSubsystemForCurrentWorld();
@@ -29,6 +29,7 @@
 #include "PCGSubsystem.h"
 #include "Biomes/LBBiomesSettings.h"
 #include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/AssetManager.h"
 #include "Grid/PCGPartitionActor.h"
 #include "Misc/MapErrors.h"
 #include "Misc/UObjectToken.h"
@@ -91,24 +92,94 @@ void ULBBiomesSpawnManager::EndPlay(const EEndPlayReason::Type EndPlayReason)
 		Controller->UnRegisterManager(this);
 	}
 
+	ReleasePrefetchedSets();
+
 	Super::EndPlay(EndPlayReason);
 }
 
+void ULBBiomesSpawnManager::OnUnregister()
+{
+	ReleasePrefetchedSets();
+	
+	Super::OnUnregister();
+}
+
+void ULBBiomesSpawnManager::BeginDestroy()
+{
+	ReleasePrefetchedSets();
+	
+	Super::BeginDestroy();
+}
+
+void ULBBiomesSpawnManager::ReleasePrefetchedSets()
+{
+	for (const auto& [_, Handle]: PrefetchedSets)
+	{
+		if (Handle)
+		{
+			Handle->ReleaseHandle();
+		}
+	}
+	PrefetchedSets.Empty();
+}
+
 const TArray<FLBPCGSpawnInfo>* ULBBiomesSpawnManager::FindSet(const FString& SetName) const
+{
+	return FindSet(FName(SetName));
+}
+
+const TArray<FLBPCGSpawnInfo>* ULBBiomesSpawnManager::FindSet(FName SetName) const
 {
 	if (!Preset)
 	{
 		return nullptr;
 	}
-	
-	for (const auto& Item: Preset->Sets)
+
+	const auto SetIndex = Preset->GetIndex()->FindSetIndex(SetName);
+	return Preset->Sets.IsValidIndex(SetIndex) ? &Preset->Sets[SetIndex].Actors : nullptr;
+}
+
+TSharedPtr<FStreamableHandle> ULBBiomesSpawnManager::PrefetchSet(const FString& SetName)
+{
+	const auto* Actors = FindSet(SetName);
+	if (!Actors)
+	{
+		return nullptr;
+	}
+
+	TArray<FSoftObjectPath> MeshesToLoad;
+	bool AllLoaded = true;
+	for (const auto& Item: *Actors)
 	{
-		if (Item.Name == SetName)
+		if (!Item.Mesh.IsNull())
 		{
-			return &Item.Actors;
+			MeshesToLoad.AddUnique(Item.Mesh.ToSoftObjectPath());
+			AllLoaded &= Item.Mesh.IsValid();
 		}
 	}
-	return nullptr;
+
+	if (MeshesToLoad.IsEmpty())
+	{
+		return nullptr;
+	}
+	
+	auto& Streamable = UAssetManager::GetStreamableManager();
+	
+	// Long living handle which keeps meshes resident
+	auto& KeepAlive = PrefetchedSets.FindOrAdd(SetName);
+	if (!KeepAlive || !KeepAlive->IsActive())
+	{
+		KeepAlive = Streamable.RequestAsyncLoad(MeshesToLoad, FStreamableDelegate(), FStreamableManager::AsyncLoadHighPriority);
+	}
+
+	if (AllLoaded || !KeepAlive || KeepAlive->HasLoadCompleted())
+	{
+		return nullptr;
+	}
+
+	// Every caller gets own handle to wait on - only one complete delegate could be bound to a handle.
+	// Streamable manager merges it with already requested loading.
+	return Streamable.RequestAsyncLoad(MoveTemp(MeshesToLoad), FStreamableDelegate(), FStreamableManager::AsyncLoadHighPriority);
 }
 
 const FLBBiomeSettings* ULBBiomesSpawnManager::FindSettings(FName BiomeName) const
@@ -247,42 +318,65 @@ void ULBBiomesSpawnManager::CheckForErrors()
 
 const FLBPCGSpawnInfo* ULBBiomesSpawnManager::FindActorInfoByMesh(const TSoftObjectPtr<UStaticMesh>& Mesh, FPackedTagsEntry& OutEntry) const
 {
-	OutEntry.SetIndex = 0;
+	if (!Preset)
+	{
+		return nullptr;
+	}
 	
-	for (const auto& [_, Actors]: Preset->Sets)
+	// Index might be older than the content while the preset is edited
+	const auto Index = Preset->GetIndex();
+	const auto* Entry = Index->FindMesh(Mesh.ToSoftObjectPath());
+	if (!Entry || !Preset->Sets.IsValidIndex(Entry->SetIndex) || !Preset->Sets[Entry->SetIndex].Actors.IsValidIndex(Entry->ActorIndex))
 	{
-		OutEntry.ActorIndex = 0;
-		for (const auto& Item: Actors)
-		{
-			if (Item.Mesh == Mesh)
-			{
-				return &Item;
-			}
-			OutEntry.ActorIndex++;
-		}
-		OutEntry.SetIndex++;
+		return nullptr;
 	}
-	return nullptr;
+	
+	OutEntry.SetIndex = Entry->SetIndex;
+	OutEntry.ActorIndex = Entry->ActorIndex;
+	return &Preset->Sets[Entry->SetIndex].Actors[Entry->ActorIndex];
 }
 
 ULBBiomesInstanceUserData* ULBBiomesSpawnManager::GetExtraDataFromInstance(const UInstancedStaticMeshComponent* Component,
                                                                        const int32 InstanceId) const
 {
 	const auto TagEntry = GetTagEntryFromInstance(Component, InstanceId);
-	if (TagEntry.ActorIndex != INDEX_NONE && TagEntry.SetIndex != INDEX_NONE)
+	return GetExtraData(TagEntry.SetIndex, TagEntry.ActorIndex);
+}
+
+ULBBiomesInstanceUserData* ULBBiomesSpawnManager::GetExtraData(int32 SetIndex, int32 ActorIndex) const
+{
+	if (Preset && ActorIndex != INDEX_NONE && SetIndex != INDEX_NONE)
 	{
-		return Preset->Sets[TagEntry.SetIndex].Actors[TagEntry.ActorIndex].UserData; 
+		return Preset->GetIndex()->GetUserData(SetIndex, ActorIndex); 
 	}
 	return nullptr;
 }
 
-ULBBiomesInstanceUserData* ULBBiomesSpawnManager::GetExtraData(int32 SetIndex, int32 ActorIndex) const
+FName ULBBiomesSpawnManager::GetSetName(int32 SetIndex) const
 {
-	if (ActorIndex != INDEX_NONE && SetIndex != INDEX_NONE)
+	if (Preset && Preset->Sets.IsValidIndex(SetIndex))
 	{
-		return Preset->Sets[SetIndex].Actors[ActorIndex].UserData; 
+		return FName(Preset->Sets[SetIndex].Name);
 	}
-	return nullptr;
+	return NAME_None;
+}
+
+float ULBBiomesSpawnManager::GetRegrowthDelay(int32 SetIndex, int32 ActorIndex) const
+{
+	if (const auto* UserData = GetExtraData(SetIndex, ActorIndex))
+	{
+		const auto Delay = UserData->GetRegrowthDelay();
+		if (Delay >= 0.f)
+		{
+			return Delay;
+		}
+	}
+	
+	if (Preset && Preset->Sets.IsValidIndex(SetIndex))
+	{
+		return Preset->Sets[SetIndex].RegrowthDelay;
+	}
+	return 0.f;
 }
 
 bool ULBBiomesSpawnManager::GetSpawnInfoFromInstance(
@@ -299,37 +393,51 @@ bool ULBBiomesSpawnManager::GetSpawnInfoFromInstance(
 	return false;
 }
 
-ULBBiomesSpawnManager::FPackedTagsEntry ULBBiomesSpawnManager::GetTagEntryFromInstance(const UInstancedStaticMeshComponent* Component, const int32 InstanceId)
+ULBBiomesSpawnManager::FPackedTagsEntry ULBBiomesSpawnManager::GetTagEntry(const UInstancedStaticMeshComponent* Component) const
 {
-	if (Component->PerInstanceSMCustomData.IsEmpty())
+	if (!Component)
 	{
 		return {};
 	}
 	
-	const auto& Data = Component->PerInstanceSMCustomData;
-	const auto Offset = Component->NumCustomDataFloats * InstanceId;
-	if (Data.Num() >= Offset + Component->NumCustomDataFloats)
+	const TObjectKey<UStaticMesh> Mesh(Component->GetStaticMesh());
 	{
-		return *(FPackedTagsEntry*)&Data[Offset];
+		FReadScopeLock Lock(ComponentTagsLock);
+		if (const auto* Tags = ComponentTags.Find(Component); Tags && Tags->Mesh == Mesh)
+		{
+			return Tags->Entry;
+		}
 	}
 
-	return {};
-}
-
-void ULBBiomesSpawnManager::SetTagEntryFromInstance(UInstancedStaticMeshComponent* Component,
-	const int32 InstanceId, const FPackedTagsEntry& Data)
-{
-	if (Component->PerInstanceSMCustomData.IsEmpty())
+	FPackedTagsEntry Result;
+	FindActorInfoByMesh(Component->GetStaticMesh(), Result);
+	
+	FWriteScopeLock Lock(ComponentTagsLock);
+	
+	// Drop entries of destroyed components from time to time
+	if (ComponentTags.Num() >= NextComponentTagsPrune)
 	{
-		return;
+		for (auto It = ComponentTags.CreateIterator(); It; ++It)
+		{
+			if (!It->Key.ResolveObjectPtr())
+			{
+				It.RemoveCurrent();
+			}
+		}
+		NextComponentTagsPrune = FMath::Max(64, ComponentTags.Num() * 2);
 	}
 	
-	auto& CustomData = Component->PerInstanceSMCustomData;
-	const auto Offset = Component->NumCustomDataFloats * InstanceId;
-	if (CustomData.Num() >= Offset + Component->NumCustomDataFloats)
+	ComponentTags.Add(Component, {Mesh, Result});
+	return Result;
+}
+
+ULBBiomesSpawnManager::FPackedTagsEntry ULBBiomesSpawnManager::GetTagEntryFromInstance(const UInstancedStaticMeshComponent* Component, const int32 InstanceId) const
+{
+	if (!Component || !Component->IsValidInstance(InstanceId))
 	{
-		FMemory::Memcpy(&CustomData[Offset], &Data, sizeof(FPackedTagsEntry));
+		return {};
 	}
+	return GetTagEntry(Component);
 }
 
 
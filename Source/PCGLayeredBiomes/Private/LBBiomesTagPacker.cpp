@@ -24,6 +24,7 @@
 
 #include "LBBiomesTagPacker.h"
 
+#include "LBBiomesLog.h"
 #include "LBBiomesSpawnManager.h"
 #include "PCGComponent.h"
 #include "Engine/StaticMesh.h"
@@ -33,28 +34,14 @@
 void ULBBiomesTagPacker::PackInstances_Implementation(FPCGContext& Context, const UPCGSpatialData* InSpatialData,
 	const FPCGMeshInstanceList& InstanceList, FPCGPackedCustomData& OutPackedCustomData) const
 {
-	if (const auto* Actor = Context.SourceComponent->GetOriginalComponent()->GetOwner())
+	// All instances of the list share the same (SetIndex, ActorIndex), it's resolved from the mesh of spawned component.
+	// Only ensure that the mesh can be resolved, to report broken presets during generation.
+	if (const auto* Manager = ULBBiomesSpawnManager::GetManager(Context.SourceComponent.Get()))
 	{
-		if (const auto* Manager = Actor->GetComponentByClass<ULBBiomesSpawnManager>())
+		ULBBiomesSpawnManager::FPackedTagsEntry TagsEntry;
+		if (!Manager->FindActorInfoByMesh(InstanceList.Descriptor.StaticMesh, TagsEntry))
 		{
-			ULBBiomesSpawnManager::FPackedTagsEntry TagsEntry;
-			if (auto* Info = Manager->FindActorInfoByMesh(InstanceList.Descriptor.StaticMesh, TagsEntry))
-			{
-				if (!Info->UserData)
-				{
-					return;
-				}
-
-				TArray<ULBBiomesSpawnManager::FPackedTagsEntry> TypedData;
-				TypedData.Init(TagsEntry, InstanceList.Instances.Num());
-
-				constexpr auto FloatsPerTag = sizeof(ULBBiomesSpawnManager::FPackedTagsEntry) / sizeof(float);
-				OutPackedCustomData.NumCustomDataFloats = FloatsPerTag;
-				
-				const auto NumFloats = TypedData.Num() * FloatsPerTag;
-				OutPackedCustomData.CustomData.SetNum(NumFloats);
-				FMemory::Memcpy(&OutPackedCustomData.CustomData[0], &TypedData[0], NumFloats * sizeof(float));
-			}
+			UE_LOG(LogBiomes, Verbose, TEXT("Mesh %s is not found in spawn preset"), *InstanceList.Descriptor.StaticMesh.ToString());
 		}
 	}
 }
@@ -25,7 +25,14 @@
 #include "LBPCGSpawnStructures.h"
 
 #include "PCGCrc.h"
+#include "Engine/StaticMesh.h"
 #include "Serialization/ArchiveCrc32.h"
+#include "UObject/ObjectSaveContext.h"
+
+float ULBBiomesInstanceUserData::GetRegrowthDelay_Implementation() const
+{
+	return -1.f;
+}
 
 FPCGCrc FLBPCGSpawnInfo::ComputeCrc() const
 {
@@ -34,7 +41,49 @@ FPCGCrc FLBPCGSpawnInfo::ComputeCrc() const
 	return FPCGCrc(Ar.GetCrc());
 }
 
+int32 FLBPCGSpawnPresetIndex::FindSetIndex(FName SetName) const
+{
+	const auto* Result = Sets.Find(SetName);
+	return Result ? *Result : INDEX_NONE;
+}
+
+const FLBPCGSpawnPresetIndex::FActorEntry* FLBPCGSpawnPresetIndex::FindMesh(const FSoftObjectPath& Mesh) const
+{
+	return Meshes.Find(Mesh);
+}
+
+ULBBiomesInstanceUserData* FLBPCGSpawnPresetIndex::GetUserData(int32 SetIndex, int32 ActorIndex) const
+{
+	if (!SetOffsets.IsValidIndex(SetIndex) || ActorIndex < 0)
+	{
+		return nullptr;
+	}
+
+	const auto Index = SetOffsets[SetIndex] + ActorIndex;
+	const auto End = SetOffsets.IsValidIndex(SetIndex + 1) ? SetOffsets[SetIndex + 1] : UserData.Num();
+	return Index < End ? UserData[Index] : nullptr;
+}
+
 FPCGCrc ULBPCGSpawnPreset::ComputeCrc()
+{
+#if WITH_EDITOR
+	// Content can be changed in editor at any moment - always validate the index 
+	const auto Crc = ComputeContentCrc();
+	{
+		FWriteScopeLock Lock(IndexLock);
+		if (CompiledIndex && !(CompiledIndex->Crc == Crc))
+		{
+			CompiledIndex.Reset();
+		}
+	}
+	return Crc;
+#else
+	// Cooked presets are immutable
+	return GetIndex()->Crc;
+#endif
+}
+
+FPCGCrc ULBPCGSpawnPreset::ComputeContentCrc()
 {
 	FArchiveCrc32 Ar;
 	for (auto& Item: Sets)
@@ -47,15 +96,168 @@ FPCGCrc ULBPCGSpawnPreset::ComputeCrc()
 
 bool ULBPCGSpawnPreset::HasUserData() const
 {
+	return GetIndex()->HasUserData;
+}
+
+FLBPCGSpawnPresetIndexRef ULBPCGSpawnPreset::GetIndex() const
+{
+	{
+		FReadScopeLock Lock(IndexLock);
+		if (CompiledIndex)
+		{
+			return CompiledIndex.ToSharedRef();
+		}
+	}
+
+	// Another thread might have built it meanwhile
+	FWriteScopeLock Lock(IndexLock);
+	if (!CompiledIndex)
+	{
+		CompiledIndex = BuildIndex();
+	}
+	return CompiledIndex.ToSharedRef();
+}
+
+void ULBPCGSpawnPreset::InvalidateIndex()
+{
+	// Users of the previous index keep it alive until they are done
+	FWriteScopeLock Lock(IndexLock);
+	CompiledIndex.Reset();
+}
+
+FLBPCGSpawnPresetIndexRef ULBPCGSpawnPreset::BuildIndex() const
+{
+	const auto Result = MakeShared<FLBPCGSpawnPresetIndex, ESPMode::ThreadSafe>();
+	auto& Index = *Result;
+	
+	Index.Crc = const_cast<ULBPCGSpawnPreset*>(this)->ComputeContentCrc();
+	Index.Sets.Reserve(Sets.Num());
+	Index.SetOffsets.Reserve(Sets.Num());
+	
+	for (int32 SetIndex = 0; SetIndex < Sets.Num(); ++SetIndex)
+	{
+		const auto& Name = Sets[SetIndex].Name;
+		const auto& Actors = Sets[SetIndex].Actors;
+		
+		// Sets are searched by first match, keep the same behaviour for duplicated names
+		if (!Index.Sets.Contains(FName(Name)))
+		{
+			Index.Sets.Add(FName(Name), SetIndex);
+		}
+		Index.SetOffsets.Add(Index.UserData.Num());
+
+		for (int32 ActorIndex = 0; ActorIndex < Actors.Num(); ++ActorIndex)
+		{
+			const auto& Actor = Actors[ActorIndex];
+			
+			Index.UserData.Add(Actor.UserData);
+			Index.HasUserData |= Actor.UserData != nullptr;
+			
+			if (!Actor.Mesh.IsNull() && !Index.Meshes.Contains(Actor.Mesh.ToSoftObjectPath()))
+			{
+				Index.Meshes.Add(Actor.Mesh.ToSoftObjectPath(), {SetIndex, ActorIndex});
+			}
+		}
+	}
+	return Result;
+}
+
+void ULBPCGSpawnPreset::PostLoad()
+{
+	Super::PostLoad();
+
+	// Build lookup tables on load, so first generation doesn't pay for it
+	GetIndex();
+}
+
+void ULBPCGSpawnPreset::PreSave(FObjectPreSaveContext SaveContext)
+{
+	Super::PreSave(SaveContext);
+
+#if WITH_EDITOR
+	if (RefreshMeshBounds())
+	{
+		InvalidateIndex();
+	}
+#endif
+}
+
+#if WITH_EDITOR
+
+void ULBPCGSpawnPreset::PostInitProperties()
+{
+	Super::PostInitProperties();
+
+	if (!HasAnyFlags(RF_ClassDefaultObject))
+	{
+		// Meshes can be reimported at any moment, keep bounds in sync with them
+		ObjectChangedHandle = FCoreUObjectDelegates::OnObjectPropertyChanged.AddUObject(this, &ULBPCGSpawnPreset::OnObjectPropertyChanged);
+	}
+}
+
+void ULBPCGSpawnPreset::BeginDestroy()
+{
+	FCoreUObjectDelegates::OnObjectPropertyChanged.Remove(ObjectChangedHandle);
+	
+	Super::BeginDestroy();
+}
+
+void ULBPCGSpawnPreset::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	RefreshMeshBounds();
+	InvalidateIndex();
+}
+
+bool ULBPCGSpawnPreset::RefreshMeshBounds()
+{
+	bool Changed = false;
+	for (auto& Item: Sets)
+	{
+		for (auto& Actor: Item.Actors)
+		{
+			FBox Bounds(ForceInit);
+			if (const auto* Mesh = Actor.Mesh.LoadSynchronous())
+			{
+				Bounds = Mesh->GetBounds().GetBox();
+			}
+
+			if (!Actor.MeshBounds.Equals(Bounds) || Actor.MeshBounds.IsValid != Bounds.IsValid)
+			{
+				Actor.MeshBounds = Bounds;
+				Changed = true;
+			}
+		}
+	}
+	return Changed;
+}
+
+void ULBPCGSpawnPreset::OnObjectPropertyChanged(UObject* Object, FPropertyChangedEvent& PropertyChangedEvent)
+{
+	const auto* Mesh = Cast<UStaticMesh>(Object);
+	if (!Mesh)
+	{
+		return;
+	}
+
+	const FSoftObjectPath MeshPath(Mesh);
 	for (const auto& Item: Sets)
 	{
 		for (const auto& Actor: Item.Actors)
 		{
-			if (Actor.UserData)
+			if (Actor.Mesh.ToSoftObjectPath() == MeshPath)
 			{
-				return true;
+				// Mesh of this preset was reimported or edited
+				Modify();
+				if (RefreshMeshBounds())
+				{
+					InvalidateIndex();
+				}
+				return;
 			}
 		}
 	}
-	return false;
 }
+
+#endif
@@ -0,0 +1,416 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include "Runtime/LBBiomesActorPool.h"
+
+#include "LBPCGSpawnStructures.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/World.h"
+#include "Algo/Unique.h"
+#include "Runtime/LBBiomesInstanceController.h"
+#include "Runtime/LBBiomesRuntimeSettings.h"
+
+ULBBiomesActorPool* ULBBiomesActorPool::GetInstance(const UObject* WorldContext)
+{
+	return WorldContext->GetWorld()->GetSubsystem<ULBBiomesActorPool>();
+}
+
+AActor* ULBBiomesActorPool::PromoteInstance(UInstancedStaticMeshComponent* Component, int32 InstanceId)
+{
+	if (!Component || !Component->IsValidInstance(InstanceId))
+	{
+		return nullptr;
+	}
+
+	auto* Controller = ULBBiomesInstanceController::GetInstance(this);
+	auto* UserData = ULBBiomesPCGUtils::ExtractUserData(Component, InstanceId);
+	if (!Controller || !UserData || !UserData->ActorClass)
+	{
+		return nullptr;
+	}
+
+	FTransform Transform;
+	if (!Component->GetInstanceTransform(InstanceId, Transform, true))
+	{
+		return nullptr;
+	}
+	
+	const auto Handles = Controller->HideInstances(Component, {InstanceId});
+	if (Handles.IsEmpty())
+	{
+		return nullptr;
+	}
+
+	auto* Actor = Promote(Handles[0], UserData, Transform);
+	if (!Actor)
+	{
+		Controller->ShowInstances(Handles);
+	}
+	return Actor;
+}
+
+TArray<AActor*> ULBBiomesActorPool::PromoteInstances(UInstancedStaticMeshComponent* Component, TConstArrayView<int32> InstanceIds)
+{
+	TArray<AActor*> Actors;
+	
+	auto* Controller = ULBBiomesInstanceController::GetInstance(this);
+	if (!Component || !Controller)
+	{
+		return Actors;
+	}
+
+	// Same order as handles returned by HideInstances
+	TArray<int32> Ids(InstanceIds);
+	Ids.Sort(TGreater<int32>());
+	Ids.SetNum(Algo::Unique(Ids));
+	Ids.RemoveAll([Component](int32 Id) { return !Component->IsValidInstance(Id); });
+	if (Ids.IsEmpty())
+	{
+		return Actors;
+	}
+	
+	// All instances of the component share the same spawn info
+	auto* UserData = ULBBiomesPCGUtils::ExtractUserData(Component, Ids[0]);
+	if (!UserData || !UserData->ActorClass)
+	{
+		return Actors;
+	}
+
+	TArray<FTransform> Transforms;
+	Transforms.SetNum(Ids.Num());
+	for (int32 i = 0; i < Ids.Num(); ++i)
+	{
+		Component->GetInstanceTransform(Ids[i], Transforms[i], true);
+	}
+
+	const auto Handles = Controller->HideInstances(Component, Ids);
+	if (Handles.Num() != Ids.Num())
+	{
+		// Handles can't be matched with transforms
+		Controller->ShowInstances(Handles);
+		return Actors;
+	}
+
+	TArray<FLBBiomesInstanceHandle> Failed;
+	Actors.Reserve(Handles.Num());
+	for (int32 i = 0; i < Handles.Num(); ++i)
+	{
+		if (auto* Actor = Promote(Handles[i], UserData, Transforms[i]))
+		{
+			Actors.Add(Actor);
+		}
+		else
+		{
+			Failed.Add(Handles[i]);
+		}
+	}
+
+	if (!Failed.IsEmpty())
+	{
+		Controller->ShowInstances(Failed);
+	}
+	return Actors;
+}
+
+bool ULBBiomesActorPool::DemoteActor(AActor* Actor, bool Restore)
+{
+	FLBBiomesPromotedActor Info;
+	if (!Actor || !PromotedActors.RemoveAndCopyValue(Actor, Info))
+	{
+		return false;
+	}
+	
+	Promoted.Remove(Info.Handle.Pack());
+
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(this))
+	{
+		if (Restore)
+		{
+			Controller->ShowInstances({Info.Handle});
+		}
+		else
+		{
+			Controller->RemoveHiddenInstances({Info.Handle});
+		}
+	}
+
+	Release(Info.UserDataClass, Actor);
+	return true;
+}
+
+int32 ULBBiomesActorPool::DemoteActors(TConstArrayView<AActor*> Actors, bool Restore)
+{
+	TArray<FLBBiomesInstanceHandle> Handles;
+	Handles.Reserve(Actors.Num());
+	
+	int32 NumDemoted = 0;
+	for (auto* Actor: Actors)
+	{
+		FLBBiomesPromotedActor Info;
+		if (!Actor || !PromotedActors.RemoveAndCopyValue(Actor, Info))
+		{
+			continue;
+		}
+		
+		Promoted.Remove(Info.Handle.Pack());
+		Handles.Add(Info.Handle);
+		Release(Info.UserDataClass, Actor);
+		++NumDemoted;
+	}
+
+	auto* Controller = ULBBiomesInstanceController::GetInstance(this);
+	if (Controller && !Handles.IsEmpty())
+	{
+		if (Restore)
+		{
+			Controller->ShowInstances(Handles);
+		}
+		else
+		{
+			Controller->RemoveHiddenInstances(Handles);
+		}
+	}
+	return NumDemoted;
+}
+
+AActor* ULBBiomesActorPool::FindPromotedActor(const FLBBiomesInstanceHandle& InstanceHandle) const
+{
+	return FindPromotedActor(InstanceHandle.Pack());
+}
+
+AActor* ULBBiomesActorPool::FindPromotedActor(const FLBBiomesPackedInstanceHandle& InstanceHandle) const
+{
+	const auto* Actor = Promoted.Find(InstanceHandle);
+	return Actor ? Actor->Get() : nullptr;
+}
+
+FLBBiomesInstanceHandle ULBBiomesActorPool::GetPromotedHandle(const AActor* Actor) const
+{
+	const auto* Info = PromotedActors.Find(const_cast<AActor*>(Actor));
+	return Info ? Info->Handle : FLBBiomesInstanceHandle{};
+}
+
+void ULBBiomesActorPool::Prewarm(const ULBBiomesInstanceUserData* UserData, int32 Count)
+{
+	if (!UserData || !UserData->ActorClass)
+	{
+		return;
+	}
+	
+	auto& Pool = Pools.FindOrAdd(UserData->GetClass());
+	const int32 Target = FMath::Min(Count, GetDefault<ULBBiomesRuntimeSettings>()->MaxPooledActors);
+	while (Pool.Actors.Num() < Target)
+	{
+		auto* Actor = SpawnPooledActor(UserData->ActorClass, FTransform::Identity);
+		if (!Actor)
+		{
+			return;
+		}
+		Deactivate(Actor);
+		Pool.Actors.Add(Actor);
+	}
+}
+
+void ULBBiomesActorPool::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	if (auto* Controller = Collection.InitializeDependency<ULBBiomesInstanceController>())
+	{
+		Controller->OnHiddenInstancesReleased.AddUObject(this, &ULBBiomesActorPool::ReleaseShownActors);
+	}
+}
+
+void ULBBiomesActorPool::Deinitialize()
+{
+	Super::Deinitialize();
+
+	// Actors are destroyed with the world
+	Pools.Reset();
+	Promoted.Reset();
+	PromotedActors.Reset();
+}
+
+bool ULBBiomesActorPool::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+AActor* ULBBiomesActorPool::Promote(const FLBBiomesInstanceHandle& Handle, ULBBiomesInstanceUserData* UserData,
+	const FTransform& Transform)
+{
+	// Actors are tracked by packed handles
+	const auto Packed = Handle.Pack();
+	if (!Packed)
+	{
+		return nullptr;
+	}
+	
+	// Instance was shown by someone else while its actor was still promoted
+	if (const auto* Stale = Promoted.Find(Packed))
+	{
+		FLBBiomesPromotedActor Info;
+		AActor* StaleActor = Stale->Get();
+		Promoted.Remove(Packed);
+		if (PromotedActors.RemoveAndCopyValue(StaleActor, Info))
+		{
+			Release(Info.UserDataClass, StaleActor);
+		}
+	}
+
+	auto* Actor = Acquire(UserData, Transform);
+	if (!Actor)
+	{
+		return nullptr;
+	}
+
+	Promoted.Add(Packed, Actor);
+	PromotedActors.Add(Actor, {.Handle = Handle, .UserDataClass = UserData->GetClass()});
+	Actor->OnDestroyed.AddUniqueDynamic(this, &ULBBiomesActorPool::OnPromotedActorDestroyed);
+
+	if (Actor->Implements<ULBBiomesPooledActor>())
+	{
+		ILBBiomesPooledActor::Execute_OnPromoted(Actor, Handle, UserData);
+	}
+	return Actor;
+}
+
+void ULBBiomesActorPool::ReleaseShownActors()
+{
+	const auto* Controller = ULBBiomesInstanceController::GetInstance(this);
+	if (!Controller)
+	{
+		return;
+	}
+	
+	// Instances are in the ISM again, actors don't replace them anymore
+	TArray<AActor*> Shown;
+	for (const auto& [Actor, Info]: PromotedActors)
+	{
+		if (!Controller->IsHidden(Info.Handle))
+		{
+			Shown.Add(Actor);
+		}
+	}
+
+	for (auto* Actor: Shown)
+	{
+		FLBBiomesPromotedActor Info;
+		if (PromotedActors.RemoveAndCopyValue(Actor, Info))
+		{
+			Promoted.Remove(Info.Handle.Pack());
+			Release(Info.UserDataClass, Actor);
+		}
+	}
+}
+
+void ULBBiomesActorPool::OnPromotedActorDestroyed(AActor* Actor)
+{
+	FLBBiomesPromotedActor Info;
+	if (!PromotedActors.RemoveAndCopyValue(Actor, Info))
+	{
+		return;
+	}
+	
+	Promoted.Remove(Info.Handle.Pack());
+	if (auto* Controller = ULBBiomesInstanceController::GetInstance(this))
+	{
+		Controller->ShowInstances({Info.Handle});
+	}
+}
+
+AActor* ULBBiomesActorPool::Acquire(const ULBBiomesInstanceUserData* UserData, const FTransform& Transform)
+{
+	if (auto* Pool = Pools.Find(UserData->GetClass()))
+	{
+		// Different UserData objects of the same class may spawn different actors
+		for (int32 i = Pool->Actors.Num() - 1; i >= 0; --i)
+		{
+			AActor* Actor = Pool->Actors[i];
+			if (!IsValid(Actor))
+			{
+				Pool->Actors.RemoveAtSwap(i);
+				continue;
+			}
+			
+			if (Actor->GetClass() == UserData->ActorClass)
+			{
+				Pool->Actors.RemoveAtSwap(i);
+				Activate(Actor, Transform);
+				return Actor;
+			}
+		}
+	}
+
+	return SpawnPooledActor(UserData->ActorClass, Transform);
+}
+
+void ULBBiomesActorPool::Release(TSubclassOf<ULBBiomesInstanceUserData> UserDataClass, AActor* Actor)
+{
+	if (!IsValid(Actor))
+	{
+		return;
+	}
+
+	Actor->OnDestroyed.RemoveDynamic(this, &ULBBiomesActorPool::OnPromotedActorDestroyed);
+	if (Actor->Implements<ULBBiomesPooledActor>())
+	{
+		ILBBiomesPooledActor::Execute_OnDemoted(Actor);
+	}
+	
+	auto& Pool = Pools.FindOrAdd(UserDataClass);
+	if (Pool.Actors.Num() < GetDefault<ULBBiomesRuntimeSettings>()->MaxPooledActors)
+	{
+		Deactivate(Actor);
+		Pool.Actors.Add(Actor);
+	}
+	else
+	{
+		Actor->Destroy();
+	}
+}
+
+AActor* ULBBiomesActorPool::SpawnPooledActor(TSubclassOf<AActor> ActorClass, const FTransform& Transform) const
+{
+	FActorSpawnParameters Params;
+	Params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	Params.ObjectFlags |= RF_Transient;
+	return GetWorld()->SpawnActor<AActor>(ActorClass, Transform, Params);
+}
+
+void ULBBiomesActorPool::Activate(AActor* Actor, const FTransform& Transform)
+{
+	Actor->SetActorTransform(Transform, false, nullptr, ETeleportType::ResetPhysics);
+	Actor->SetActorHiddenInGame(false);
+	Actor->SetActorEnableCollision(true);
+	Actor->SetActorTickEnabled(true);
+}
+
+void ULBBiomesActorPool::Deactivate(AActor* Actor)
+{
+	Actor->SetActorHiddenInGame(true);
+	Actor->SetActorEnableCollision(false);
+	Actor->SetActorTickEnabled(false);
+}
@@ -26,29 +26,167 @@
 
 #include "LBBiomesLog.h"
 #include "LBBiomesPCGUtils.h"
+#include "Runtime/LBBiomesRuntimeSettings.h"
+#include "Runtime/LBBiomesPartitionStore.h"
 #include "PCGComponent.h"
 #include "PCGSubsystem.h"
 #include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
 #include "Components/InstancedStaticMeshComponent.h"
 #include "Grid/PCGPartitionActor.h"
+#include "Algo/BinarySearch.h"
+#include "Algo/Unique.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/ObjectKey.h"
 
 
+namespace LBBiomesTracking
+{
+	// Tracked components of all worlds, so the engine-wide ISM delegate skips other components without looking up the controller
+	static FRWLock Lock;
+	static TSet<FObjectKey> Components;
+
+	static void SetTracked(const UInstancedStaticMeshComponent* Component, bool Tracked)
+	{
+		FWriteScopeLock WriteLock(Lock);
+		if (Tracked)
+		{
+			Components.Add(Component);
+		}
+		else
+		{
+			Components.Remove(Component);
+		}
+	}
+
+	static bool IsTracked(const UInstancedStaticMeshComponent* Component)
+	{
+		FReadScopeLock ReadLock(Lock);
+		return Components.Contains(Component);
+	}
+}
+
 bool FLBBiomesInstanceData::operator==(const FLBBiomesInstanceHandle& Handle) const
 {
 	return Id == Handle.InstanceId && ComponentName == Handle.ComponentName;
 }
 
+UInstancedStaticMeshComponent* FLBBiomesISMList::Find(const FName& ComponentName, const AActor* Owner) const
+{
+	if (const auto* Component = Components.Find(ComponentName))
+	{
+		// Component could be destroyed or renamed into another actor after the list was built
+		if (IsValid(*Component) && (*Component)->GetOwner() == Owner)
+		{
+			return *Component;
+		}
+	}
+	return nullptr;
+}
+
 ULBBiomesInstanceController::ULBBiomesInstanceController()
 {
 }
 
-void ULBBiomesInstanceController::EnsureInstancesUnique(const FTransform& Transform, const int32 OriginalIndex, const FName ComponentName, const TArray<FLBBiomesInstanceData>& Instances)
+void ULBBiomesInstanceController::FRemovedInstances::Add(int32 Id, const FTransform* Transform)
 {
-	auto* SameItem = Instances.FindByPredicate([OriginalIndex, ComponentName] (const FLBBiomesInstanceData& Item)
+	if (Removed.Num() <= Id)
 	{
-		return Item.Id == OriginalIndex && Item.ComponentName == ComponentName;
-	});
-	ensure(SameItem == nullptr);
+		Removed.SetNum(Id + 1, false);
+	}
+
+	if (!Removed[Id])
+	{
+		Removed[Id] = true;
+		++Count;
+	}
+
+	if (Transform)
+	{
+		Transforms.Add(Id, *Transform);
+	}
+}
+
+void ULBBiomesInstanceController::FRemovedInstances::Remove(int32 Id)
+{
+	if (Contains(Id))
+	{
+		Removed[Id] = false;
+		--Count;
+		Transforms.Remove(Id);
+	}
+}
+
+bool ULBBiomesInstanceController::FInstanceGroup::Contains(const FName& ComponentName, int32 Id) const
+{
+	const auto* Instances = Components.Find(ComponentName);
+	return Instances && Instances->Contains(Id);
+}
+
+void ULBBiomesInstanceController::FInstanceGroup::Add(const FName& ComponentName, int32 Id, const FTransform* Transform)
+{
+	Components.FindOrAdd(ComponentName).Add(Id, Transform);
+	Dirty = true;
+}
+
+bool ULBBiomesInstanceController::FInstanceGroup::Remove(const FName& ComponentName, int32 Id)
+{
+	auto* Instances = Components.Find(ComponentName);
+	if (!Instances || !Instances->Contains(Id))
+	{
+		return false;
+	}
+
+	Instances->Remove(Id);
+	if (Instances->Num() == 0)
+	{
+		Components.Remove(ComponentName);
+	}
+	Dirty = true;
+	return true;
+}
+
+int32 ULBBiomesInstanceController::FInstanceGroup::Num() const
+{
+	int32 Result = 0;
+	for (const auto& [_, Instances]: Components)
+	{
+		Result += Instances.Num();
+	}
+	return Result;
+}
+
+void ULBBiomesInstanceController::FInstanceGroup::Reset(const FBiomesInstances& InInstances)
+{
+	Components.Reset();
+	Dirty = true;
+	
+	for (const auto& Item: InInstances)
+	{
+		Add(Item.ComponentName, Item.Id, Item.HasTransform ? &Item.Transform : nullptr);
+	}
+}
+
+void ULBBiomesInstanceController::FInstanceGroup::ToInstances(FBiomesInstances& OutInstances) const
+{
+	OutInstances.Reserve(OutInstances.Num() + Num());
+	
+	for (const auto& [ComponentName, Instances]: Components)
+	{
+		for (TConstSetBitIterator<> It(Instances.Removed); It; ++It)
+		{
+			auto& Data = OutInstances.AddDefaulted_GetRef();
+			Data.Id = It.GetIndex();
+			Data.ComponentName = ComponentName;
+			const auto* Transform = Instances.FindTransform(Data.Id);
+			Data.HasTransform = Transform != nullptr;
+			if (Transform)
+			{
+				Data.Transform = *Transform;
+			}
+		}
+	}
 }
 
 UPCGComponent* ULBBiomesInstanceController::FindPcgComponent(const FGuid& Guid)
@@ -70,109 +208,101 @@ UPCGComponent* ULBBiomesInstanceController::FindPcgComponent(const FGuid& Guid)
 	return nullptr;
 }
 
-FLBBiomesInstanceHandle ULBBiomesInstanceController::RemoveInstanceImpl(UInstancedStaticMeshComponent* Component,
-                                                                    int32 InstanceId)
+int32 ULBBiomesInstanceController::GetGroupId(const UPCGComponent* PcgComponent)
+{
+	if (!PcgComponent->IsLocalComponent())
+	{
+		const auto MainIndex = GetMainIndex(PcgComponent);
+		return MainIndex == INDEX_NONE ? 0 : -(MainIndex + 1);
+	}
+
+	if (const auto* Actor = Cast<APCGPartitionActor>(PcgComponent->GetOwner()))
+	{
+		return GetPartitionIndex(Actor->GetGridCoord(), Actor->GetPCGGridSize()) + 1;
+	}
+	return 0;
+}
+
+FLBBiomesInstanceHandle ULBBiomesInstanceController::MakeHandle(const UInstancedStaticMeshComponent* Component,
+	int32 InstanceId)
 {
-	auto* Owner = Component->GetOwner();
+	const auto* Owner = Component->GetOwner();
 	check(Owner);
 
-	auto* PcgComponent = Owner->FindComponentByClass<UPCGComponent>();
+	const auto* PcgComponent = Owner->FindComponentByClass<UPCGComponent>();
 	if (!PcgComponent)
 	{
 		return {};
 	}
 
 	// Return a handle for original (not partitioned) component
-	FTransform Transform;
-	if (!Component->GetInstanceTransform(InstanceId, Transform))
+	FLBBiomesInstanceHandle Result;
+	Result.GroupId = GetGroupId(PcgComponent);
+	if (Result.GroupId == 0)
 	{
 		return {};
 	}
-	const auto OriginalIndex = GetOriginalIndex(Component, InstanceId);
-	if (OriginalIndex == INDEX_NONE)
+	Result.InstanceId = GetOriginalIndex(Component, InstanceId);
+	Result.ComponentName = Component->GetFName();
+	return Result;
+}
+
+FLBBiomesInstanceHandle ULBBiomesInstanceController::RemoveInstanceImpl(UInstancedStaticMeshComponent* Component,
+                                                                    int32 InstanceId)
+{
+	FTransform Transform;
+	if (!Component->GetInstanceTransform(InstanceId, Transform))
 	{
-		ensure(false);
 		return {};
 	}
-	
-	const auto [SetIndex, ActorIndex] = ULBBiomesSpawnManager::GetTagEntryFromInstance(Component, InstanceId);
-	const auto ComponentName = Component->GetFName();
 
-	if (!PcgComponent->IsLocalComponent())
+	const auto Handle = MakeHandle(Component, InstanceId);
+	if (!Handle)
 	{
-		const auto MainIndex = GetMainIndex(PcgComponent);
-		if (MainIndex == INDEX_NONE || !Mains.IsValidIndex(MainIndex))
-		{
-			return {};
-		}
-		auto& Instances = MainInstances.FindOrAdd(Mains[MainIndex]);
-		EnsureInstancesUnique(Transform, OriginalIndex, ComponentName, Instances);
-		
-		auto& Data = Instances.AddDefaulted_GetRef();
-		Data.Id = OriginalIndex;
-		Data.ComponentName = ComponentName;
-		Data.Transform = Transform;
-		
-		// Store custom data from component 
-		Data.Custom_ActorIndex = ActorIndex;
-		Data.Custom_SetIndex = SetIndex;
-		
-		FLBBiomesInstanceHandle Result;
-		Result.InstanceId = Data.Id;
-		Result.GroupId = -(MainIndex + 1);
-		Result.ComponentName = ComponentName;
-		return Result;
+		return {};
 	}
+	
+	RecordRemoval(Component, Handle, Transform);
+	return Handle;
+}
 
-	if (const auto* Actor = Cast<APCGPartitionActor>(Owner))
+void ULBBiomesInstanceController::RecordRemoval(UInstancedStaticMeshComponent* Component, const FLBBiomesInstanceHandle& Handle,
+	const FTransform& Transform)
+{
+	Track(Component);
+	
+	auto& Group = GetGroup(Handle.GroupId);
+	ensure(!Group.Contains(Handle.ComponentName, Handle.InstanceId));
+	Group.Add(Handle.ComponentName, Handle.InstanceId, &Transform);
+	Group.Components[Handle.ComponentName].Mesh = FSoftObjectPath(Component->GetStaticMesh());
+	UpdateLiveIndex(Component, Handle.InstanceId, nullptr);
+	const auto* ComponentTransform = FindComponentTransform(Handle.GroupId, Handle.ComponentName, Component);
+	if (const auto Packed = Handle.Pack(); Packed && ComponentTransform)
 	{
-		const auto ActorGridCoords = Actor->GetGridCoord();
-		const auto ActorGridSize = Actor->GetPCGGridSize();
-
-		// Ensure unique
-		if (auto* Items = PartitionedInstances.Find({ActorGridCoords, ActorGridSize}))
-		{
-			EnsureInstancesUnique(Transform, OriginalIndex, ComponentName, *Items);
-		}
-		
-		auto& Data = PartitionedInstances.FindOrAdd({ActorGridCoords, ActorGridSize}).AddDefaulted_GetRef();
-		Data.Id = OriginalIndex;
-		Data.ComponentName = ComponentName;
-		Data.Transform = Transform;
-
-		// Store custom data from component 
-		Data.Custom_ActorIndex = ActorIndex;
-		Data.Custom_SetIndex = SetIndex;
-		
-		FLBBiomesInstanceHandle Result;
-		Result.InstanceId = Data.Id;
-		Result.GroupId = GetPartitionIndex(ActorGridCoords, ActorGridSize) + 1; 
-		Result.ComponentName = ComponentName;
-		return Result;
+		RemovedIndex.Add(Packed, ComponentTransform->TransformPosition(Transform.GetLocation()));
 	}
-	return {};
+	AppendJournal(Handle, true, &Transform);
 }
 
 void ULBBiomesInstanceController::OnInstanceIndexRelocated(UInstancedStaticMeshComponent* Component,
                                                          TArrayView<const FInstancedStaticMeshDelegates::FInstanceIndexUpdateData> Data)
 {
-	if (auto* Indices = TrackedComponents.Find(Component))
+	if (auto* Mapping = TrackedComponents.Find(Component))
 	{
-		checkSlow(Indices.Num() >= Component->GetNumInstances());
-		
-		for (const auto& Item: Data)
-		{
-			if (Item.Type == FInstancedStaticMeshDelegates::EInstanceIndexUpdateType::Relocated)
-			{
-				Indices->Swap(Item.OldIndex, Item.Index);
-			}
-		}
+		FWriteScopeLock Lock(MappingLock);
+		Mapping->Relocate(Data);
 	}
 }
 
 void ULBBiomesInstanceController::OnInstanceIndexUpdated(UInstancedStaticMeshComponent* Component,
                                                        TArrayView<const FInstancedStaticMeshDelegates::FInstanceIndexUpdateData> Data)
 {
+	// Called for every ISM in the game
+	if (!Component || !LBBiomesTracking::IsTracked(Component))
+	{
+		return;
+	}
+	
 	for (const auto& Item: Data)
 	{
 		if (Item.Type == FInstancedStaticMeshDelegates::EInstanceIndexUpdateType::Relocated)
@@ -186,7 +316,7 @@ void ULBBiomesInstanceController::OnInstanceIndexUpdated(UInstancedStaticMeshCom
 	}
 }
 
-int16 ULBBiomesInstanceController::GetMainIndex(const UPCGComponent* Component)
+int32 ULBBiomesInstanceController::GetMainIndex(const UPCGComponent* Component)
 {
 	ensure(!Component->IsLocalComponent() && !Component->IsPartitioned());
 	
@@ -194,430 +324,2780 @@ int16 ULBBiomesInstanceController::GetMainIndex(const UPCGComponent* Component)
 	{
 		const auto TargetGuid = Manager->Guid;
 		ensure(TargetGuid.IsValid());
-		for (int16 i = 0; i < Mains.Num(); ++i)
-		{
-			if (Mains[i] == TargetGuid)
-			{
-				return i;
-			}
-		}
-	
-		return Mains.Add(TargetGuid);
+		return GetMainIndex(TargetGuid);
 	}
 	ensureMsgf(false, TEXT("PCG component should have ULBBiomesSpawnManager"));
 	return INDEX_NONE;
 }
 
-int16 ULBBiomesInstanceController::GetPartitionIndex(const FIntVector& ActorGridCoords, uint32 ActorGridSize)
+int32 ULBBiomesInstanceController::GetMainIndex(const FGuid& Guid)
 {
-	for (int16 i = 0; i < Partitions.Num(); ++i)
 	{
-		const auto& Partition = Partitions[i];
-		if (Partition.GridSize == ActorGridSize && Partition.GridCoord == ActorGridCoords)
+		FReadScopeLock Lock(GroupsLock);
+		if (const auto* Index = MainIndices.Find(Guid))
 		{
-			return i;
+			return *Index;
 		}
 	}
-	
-	return Partitions.Add(FLBBiomesPartition{ActorGridCoords, ActorGridSize});
+
+	FWriteScopeLock Lock(GroupsLock);
+	return AddMain(Guid);
 }
 
-void ULBBiomesInstanceController::InitTrackedComponent(const UInstancedStaticMeshComponent* Component, TArray<signed int>& Mapping)
+int32 ULBBiomesInstanceController::GetPartitionIndex(const FIntVector& ActorGridCoords, uint32 ActorGridSize)
 {
-	Mapping.SetNumUninitialized(Component->GetNumInstances());
-	// Fill the array with initial indices
-	for (int i = 0; i < Mapping.Num(); ++i)
+	const FLBBiomesPartition Partition{ActorGridCoords, ActorGridSize};
 	{
-		Mapping[i] = i;
+		FReadScopeLock Lock(GroupsLock);
+		if (const auto* Index = PartitionIndices.Find(Partition))
+		{
+			return *Index;
+		}
 	}
+
+	FWriteScopeLock Lock(GroupsLock);
+	return AddPartition(Partition);
 }
 
-int32 ULBBiomesInstanceController::GetOriginalIndex(UInstancedStaticMeshComponent* Component, int32 InstanceId)
+int32 ULBBiomesInstanceController::FindMainIndex(const FGuid& Guid) const
 {
-	auto& Mapping =  TrackedComponents.FindOrAdd(Component);
-	if (Mapping.IsEmpty())
-	{
-		InitTrackedComponent(Component, Mapping);
-		
-		return InstanceId;
-	}
-	checkSlow(Mapping.Num() >= Component->GetNumInstances());
-	return Mapping[InstanceId];
+	FReadScopeLock Lock(GroupsLock);
+	const auto* Index = MainIndices.Find(Guid);
+	return Index ? *Index : INDEX_NONE;
 }
 
-void ULBBiomesInstanceController::SetOriginalIndex(const UInstancedStaticMeshComponent* Component, int32 OriginalId,
-	int32 InstanceId)
+int32 ULBBiomesInstanceController::FindPartitionIndex(const FLBBiomesPartition& Partition) const
 {
-	auto& Mapping =  TrackedComponents.FindOrAdd(Component);
-	if (Mapping.IsEmpty())
-	{
-		InitTrackedComponent(Component, Mapping);
-	}
-	checkSlow(Mapping.Num() >= Component->GetNumInstances());
-	Mapping[InstanceId] = OriginalId;
+	FReadScopeLock Lock(GroupsLock);
+	const auto* Index = PartitionIndices.Find(Partition);
+	return Index ? *Index : INDEX_NONE;
 }
 
-void ULBBiomesInstanceController::Track(UInstancedStaticMeshComponent* Component)
+FGuid ULBBiomesInstanceController::GetMainGuid(int32 Index) const
 {
-	auto& Mapping =  TrackedComponents.FindOrAdd(Component);
-	if (Mapping.IsEmpty())
-	{
-		InitTrackedComponent(Component, Mapping);
-	}
+	FReadScopeLock Lock(GroupsLock);
+	return Mains[Index];
 }
 
-ULBBiomesInstanceController* ULBBiomesInstanceController::GetInstance(const UObject* WorldContext)
+FLBBiomesPartition ULBBiomesInstanceController::GetPartition(int32 Index) const
 {
-	return WorldContext->GetWorld()->GetSubsystem<ULBBiomesInstanceController>();
+	FReadScopeLock Lock(GroupsLock);
+	return Partitions[Index];
 }
 
-FLBBiomesInstanceHandle ULBBiomesInstanceController::RemoveInstance(UInstancedStaticMeshComponent* Component,
-	int32 InstanceId)
+int32 ULBBiomesInstanceController::AddMain(const FGuid& Guid)
 {
-	if (!Component->IsValidInstance(InstanceId))
+	if (const auto* Index = MainIndices.Find(Guid))
 	{
-		return {};
+		return *Index;
 	}
-	
-	if (const auto Handle = RemoveInstanceImpl(Component, InstanceId))
+
+	// Handles are packed with 24 bit group ids
+	ensureMsgf(Mains.Num() < FLBBiomesPackedInstanceHandle::MaxGroupId, TEXT("Too many PCG components for biome handles"));
+	const int32 Index = Mains.Add(Guid);
+	MainIndices.Add(Guid, Index);
+	return Index;
+}
+
+int32 ULBBiomesInstanceController::AddPartition(const FLBBiomesPartition& Partition)
+{
+	if (const auto* Index = PartitionIndices.Find(Partition))
 	{
-		ensure(Component->RemoveInstance(InstanceId));
-		return Handle;
+		return *Index;
 	}
-	return {};
+
+	ensureMsgf(Partitions.Num() < FLBBiomesPackedInstanceHandle::MaxGroupId, TEXT("Too many partitions for biome handles"));
+	const int32 Index = Partitions.Add(Partition);
+	PartitionIndices.Add(Partition, Index);
+	return Index;
 }
 
-bool ULBBiomesInstanceController::RestoreInstanceImpl(const FName& ComponentName, const FLBBiomesInstanceData& Data, AActor* Actor)
+ULBBiomesInstanceController::FInstanceGroup& ULBBiomesInstanceController::GetGroup(int32 GroupId)
 {
-	if (UInstancedStaticMeshComponent* Component = FindISM(Actor, ComponentName))
+	auto& Group = GetGroupSlot(GroupId);
+	if (GroupId > 0)
 	{
-		const auto InstanceId = Component->AddInstance(Data.Transform);
-					
-		SetOriginalIndex(Component, Data.Id, InstanceId);
-					
-		ULBBiomesSpawnManager::SetTagEntryFromInstance(Component, InstanceId,{
-			                                             .SetIndex = Data.Custom_SetIndex,
-			                                             .ActorIndex = Data.Custom_ActorIndex
-		                                             });
-					
-		return true;
+		PageInPartition(GroupId - 1);
 	}
-	return false;
+	return Group;
 }
 
-bool ULBBiomesInstanceController::RestoreInstance(const FLBBiomesInstanceHandle& InstanceHandle)
+ULBBiomesInstanceController::FInstanceGroup& ULBBiomesInstanceController::GetGroupSlot(int32 GroupId)
 {
-	FResult Result = {};
-	if (FindDataByHandle(InstanceHandle, Result))
+	check(IsInGameThread() && GroupId != 0);
+
+	// Indices might be added from other threads, groups are created on demand
+	auto& Groups = GroupId < 0 ? MainGroups : PartitionGroups;
+	const int32 Index = GroupId < 0 ? -(GroupId + 1) : GroupId - 1;
+	if (!Groups.IsValidIndex(Index))
 	{
-		if (Result.Actor)
+		const int32 Num = Groups.Num();
+		Groups.SetNum(Index + 1);
+		
+		// State of partitions is in the store
+		if (GroupId > 0 && PartitionStore)
 		{
-			const auto& Data = Result.GetData();
-
-			RestoreInstanceImpl(InstanceHandle.ComponentName, Data, Result.Actor);
+			for (int32 i = Num; i < Groups.Num(); ++i)
+			{
+				Groups[i].Resident = false;
+			}
 		}
-		
-		Result.Instances->RemoveAtSwap(Result.Index, EAllowShrinking::No);
-		return true;
 	}
-	return false;
+	return Groups[Index];
 }
 
-bool ULBBiomesInstanceController::FindDataByHandle(const FLBBiomesInstanceHandle& Handle, FResult& Result)
+void ULBBiomesInstanceController::PageInPartition(int32 Index)
 {
-	if (!Handle)
+	auto& Group = PartitionGroups[Index];
+	if (Group.Resident)
 	{
-		return false;
+		return;
 	}
 
-	const auto* PCG = UPCGSubsystem::GetSubsystemForCurrentWorld();
-	if (!PCG)
+	const auto Partition = GetPartition(Index);
+	if (auto* Staged = StagedChunks.Find(Partition))
 	{
-		return false;
+		// Still not saved
+		Group = MoveTemp(*Staged);
+		Group.Dirty = true;
+		StagedChunks.Remove(Partition);
 	}
-
-	if (Handle.GroupId < 0)
+	else if (auto* Read = ChunkReads.Find(Partition))
 	{
-		const auto MainIndex = -(Handle.GroupId + 1);
-		if (!Mains.IsValidIndex(MainIndex))
-		{
-			return false;
-		}
-		auto& Instances = MainInstances.FindOrAdd(Mains[MainIndex]);
-		const auto Index = Instances.IndexOfByKey(Handle);
-		if (Index == INDEX_NONE)
+		Group = MoveTemp(Read->GetResult());
+		Group.Dirty = false;
+		ChunkReads.Remove(Partition);
+	}
+	else
+	{
+		Group = {};
+		if (PartitionStore)
 		{
-			return false;
+			ChunkWrites.Wait();
+			ReadChunk(PartitionStore, Partition, Group);
 		}
+		Group.Dirty = false;
+	}
+	Group.Resident = true;
+	IndexGroup(Index + 1, Group, true);
+	DirtySnapshotGroups.Add(Index + 1);
+}
 
-		if (UPCGComponent* Component = FindPcgComponent(Mains[MainIndex]))
-		{
-			Result.Actor = Component->GetOwner();
-		}
-		Result.Index = Index;
-		Result.Instances = &Instances;
-		return true;
+void ULBBiomesInstanceController::PageOutPartition(int32 Index)
+{
+	auto& Group = PartitionGroups[Index];
+	if (!PartitionStore || !Group.Resident)
+	{
+		return;
 	}
 
-	const auto PartitionIndex = Handle.GroupId - 1;
-	if (!Partitions.IsValidIndex(PartitionIndex))
+	IndexGroup(Index + 1, Group, false);
+	if (Group.Dirty)
 	{
-		return false;
+		// Store keeps only saved progress
+		StagedChunks.Add(GetPartition(Index), MoveTemp(Group));
 	}
-	const auto& Partition = Partitions[PartitionIndex];
-	
-	if (auto* Instances = PartitionedInstances.Find(Partition))
+	Group = {};
+	Group.Resident = false;
+	// Snapshot includes only groups kept in memory
+	DirtySnapshotGroups.Add(Index + 1);
+}
+
+void ULBBiomesInstanceController::PageOutUnloadedPartitions()
+{
+	const auto* PCG = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	for (int32 i = 0; i < PartitionGroups.Num(); ++i)
 	{
-		const auto Index = Instances->IndexOfByKey(Handle);
-		if (Index == INDEX_NONE)
+		const auto Partition = GetPartition(i);
+		if (!PCG || !PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false))
 		{
-			return false;
+			PageOutPartition(i);
 		}
-
-		Result.Actor = PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false);
-		Result.Index = Index;
-		Result.Instances = Instances;
-		return true;
 	}
-	return false;
 }
 
-bool ULBBiomesInstanceController::GetInstanceTransform(const FLBBiomesInstanceHandle& InstanceHandle, FTransform& InstanceTransform)
+void ULBBiomesInstanceController::RequestChunk(const FLBBiomesPartition& Partition)
 {
-	FResult Result = {};
-	if (FindDataByHandle(InstanceHandle, Result))
+	if (!PartitionStore || StagedChunks.Contains(Partition) || ChunkReads.Contains(Partition))
 	{
-		InstanceTransform = Result.GetData().Transform;
-		return true;
+		return;
 	}
-	return false;
+
+	// Store is kept alive by the controller, which waits for reads before it's changed
+	ChunkReads.Add(Partition, UE::Tasks::Launch(UE_SOURCE_LOCATION, [Store = PartitionStore.Get(), Partition]
+	{
+		FInstanceGroup Group;
+		ReadChunk(Store, Partition, Group);
+		return Group;
+	}, UE::Tasks::Prerequisites(ChunkWrites)));
 }
 
-ULBBiomesInstanceUserData* ULBBiomesInstanceController::GetUserData(const FLBBiomesInstanceHandle& InstanceHandle)
+void ULBBiomesInstanceController::WaitForChunks()
 {
-	FResult Result = {};
-	if (FindDataByHandle(InstanceHandle, Result))
+	ChunkWrites.Wait();
+	for (auto& [_, Read]: ChunkReads)
 	{
-		if (auto* Manager = ULBBiomesSpawnManager::GetManager(Result.Actor))
-		{
-			const auto& Data = Result.GetData();
-			return Manager->GetExtraData(Data.Custom_SetIndex, Data.Custom_ActorIndex);
-		}
+		Read.Wait();
 	}
-	return nullptr;
 }
 
-FLBBiomesPersistentInstancesData ULBBiomesInstanceController::GetPersistentData() const
+void ULBBiomesInstanceController::WriteChunk(const FLBBiomesPartition& Partition, const FInstanceGroup& Group, TArray<uint8>& OutBytes)
 {
-	TArray<FLBBiomesPersistentMainInstances> MainData;
-	MainData.Reserve(MainInstances.Num());
-	for (const auto& [Guid, Instances]: MainInstances)
+	// Chunk is the persistent data of a single partition
+	FLBBiomesPersistentInstancesData Data;
+	Data.Partitions.Add(Partition);
+	auto& Item = Data.PartitionedInstances.Add_GetRef({.Partition = Partition});
+	Group.ToInstances(Item.Instances);
+
+	FMemoryWriter Writer(OutBytes);
+	Data.Serialize(Writer);
+}
+
+bool ULBBiomesInstanceController::ReadChunk(const ULBBiomesPartitionStore* Store, const FLBBiomesPartition& Partition,
+	FInstanceGroup& OutGroup)
+{
+	TArray<uint8> Bytes;
+	if (!Store || !Store->LoadChunk(Partition, Bytes))
 	{
-		MainData.Add({.Guid = Guid, .Instances = Instances});
+		return false;
 	}
 
-	TArray<FLBBiomesPersistentPartitionedInstances> PartitionedData;
-	PartitionedData.Reserve(PartitionedInstances.Num());
-	for (const auto& [Partition, Instances]: PartitionedInstances)
+	FLBBiomesPersistentInstancesData Data;
+	FMemoryReader Reader(Bytes);
+	if (!Data.Serialize(Reader) || Reader.IsError() || Data.PartitionedInstances.IsEmpty()
+		|| !(Data.PartitionedInstances[0].Partition == Partition))
 	{
-		PartitionedData.Add({.Partition = Partition, .Instances = Instances});
+		UE_LOG(LogBiomes, Error, TEXT("Invalid chunk of partition: %d, %d, %d"),
+			Partition.GridCoord.X, Partition.GridCoord.Y, Partition.GridCoord.Z);
+		return false;
 	}
 
-	return {
-		.Mains = Mains,
-		.Partitions = Partitions,
-		.MainInstances = MoveTemp(MainData),
-		.PartitionedInstances = MoveTemp(PartitionedData)
-	};
+	OutGroup.Reset(Data.PartitionedInstances[0].Instances);
+	OutGroup.Dirty = false;
+	return true;
 }
 
-void ULBBiomesInstanceController::SetPersistentData(const FLBBiomesPersistentInstancesData& Data)
+void ULBBiomesInstanceController::SetPartitionStore(ULBBiomesPartitionStore* Store)
 {
-	const auto* PCG = UPCGSubsystem::GetSubsystemForCurrentWorld();
-
-	// Now I am using inefficient approach - restore the state of all partition actors and then remove all from new data.
-	// So if these lists are equals, we waste a lot of resources doing nothing
-	if (PCG)
+	if (Store == PartitionStore)
+	{
+		return;
+	}
+	
+	FlushPendingRequests();
+	while (!ReadingPartitions.IsEmpty())
 	{
-		if (!MainInstances.IsEmpty())
+		if (auto* Actor = ReadingPartitions.Pop().Get())
 		{
-			for (const auto& [Guid, Instances]: MainInstances)
-			{
-				if (const auto* Component = FindPcgComponent(Guid))
-				{
-					for (const auto& InstanceData: Instances)
-					{
-						RestoreInstanceImpl(InstanceData.ComponentName, InstanceData, Component->GetOwner());
-					}
-				}
-			}
+			StartLoadingPartition(Actor);
 		}
+	}
+	while (!LoadingPartitions.IsEmpty())
+	{
+		CompleteLoadingPartition(LoadingPartitions.Last()->Actor.Get());
+	}
 
-		if (!PartitionedInstances.IsEmpty())
+	const auto* PCG = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	for (int32 i = 0; i < PartitionGroups.Num(); ++i)
+	{
+		auto& Group = PartitionGroups[i];
+		const auto Partition = GetPartition(i);
+		if (!Store || (PCG && PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false)))
+		{
+			// ISM of loaded partitions matches the current state, it will be written to the new store
+			PageInPartition(i);
+			Group.Dirty = true;
+		}
+		else
+		{
+			IndexGroup(i + 1, Group, false);
+			Group = {};
+			Group.Resident = false;
+		}
+	}
+	
+	WaitForChunks();
+	ChunkReads.Reset();
+	StagedChunks.Reset();
+	PartitionStore = Store;
+}
+
+void ULBBiomesInstanceController::SavePartitions()
+{
+	if (!PartitionStore)
+	{
+		return;
+	}
+
+	// Serialize on the game thread, the state is changed here
+	TArray<TPair<FLBBiomesPartition, TArray<uint8>>> Chunks;
+	for (int32 i = 0; i < PartitionGroups.Num(); ++i)
+	{
+		auto& Group = PartitionGroups[i];
+		if (Group.Resident && Group.Dirty)
+		{
+			auto& [Partition, Bytes] = Chunks.AddDefaulted_GetRef();
+			Partition = GetPartition(i);
+			if (!Group.IsEmpty())
+			{
+				WriteChunk(Partition, Group, Bytes);
+			}
+			Group.Dirty = false;
+		}
+	}
+	for (const auto& [Partition, Group]: StagedChunks)
+	{
+		auto& [_, Bytes] = Chunks.Add_GetRef({Partition, {}});
+		if (!Group.IsEmpty())
+		{
+			WriteChunk(Partition, Group, Bytes);
+		}
+	}
+	StagedChunks.Reset();
+
+	if (Chunks.IsEmpty())
+	{
+		return;
+	}
+
+	// Writes go in order of saves, reads of these partitions wait for them
+	ChunkWrites = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Store = PartitionStore.Get(), Chunks = MoveTemp(Chunks)]
+	{
+		for (const auto& [Partition, Bytes]: Chunks)
+		{
+			if (Bytes.IsEmpty())
+			{
+				Store->RemoveChunk(Partition);
+			}
+			else
+			{
+				Store->SaveChunk(Partition, Bytes);
+			}
+		}
+	}, UE::Tasks::Prerequisites(ChunkWrites));
+}
+
+int32 ULBBiomesInstanceController::FIndexMapping::ToOriginal(int32 LocalId) const
+{
+	if (!DenseLocalToOriginal.IsEmpty())
+	{
+		return DenseLocalToOriginal.IsValidIndex(LocalId) ? DenseLocalToOriginal[LocalId] : LocalId;
+	}
+	const auto* OriginalId = LocalToOriginal.Find(LocalId);
+	return OriginalId ? *OriginalId : LocalId;
+}
+
+int32 ULBBiomesInstanceController::FIndexMapping::ToLocal(int32 OriginalId) const
+{
+	if (!DenseOriginalToLocal.IsEmpty())
+	{
+		return DenseOriginalToLocal.IsValidIndex(OriginalId) ? DenseOriginalToLocal[OriginalId] : OriginalId;
+	}
+	const auto* LocalId = OriginalToLocal.Find(OriginalId);
+	return LocalId ? *LocalId : OriginalId;
+}
+
+void ULBBiomesInstanceController::FIndexMapping::Set(int32 LocalId, int32 OriginalId)
+{
+	const auto PrevOriginalId = ToOriginal(LocalId);
+	if (PrevOriginalId == OriginalId)
+	{
+		return;
+	}
+
+	// Give the previous place of OriginalId to the instance which was at LocalId, so both directions stay consistent
+	const auto PrevLocalId = ToLocal(OriginalId);
+	Link(LocalId, OriginalId);
+	Link(PrevLocalId, PrevOriginalId);
+}
+
+void ULBBiomesInstanceController::FIndexMapping::Swap(int32 LocalA, int32 LocalB)
+{
+	const auto OriginalA = ToOriginal(LocalA);
+	const auto OriginalB = ToOriginal(LocalB);
+	Link(LocalA, OriginalB);
+	Link(LocalB, OriginalA);
+}
+
+void ULBBiomesInstanceController::FIndexMapping::Relocate(
+	TConstArrayView<FInstancedStaticMeshDelegates::FInstanceIndexUpdateData> Data)
+{
+	int32 NumRelocated = 0;
+	int32 MaxRelocated = 0;
+	for (const auto& Item: Data)
+	{
+		if (Item.Type == FInstancedStaticMeshDelegates::EInstanceIndexUpdateType::Relocated)
+		{
+			++NumRelocated;
+			MaxRelocated = FMath::Max(MaxRelocated, FMath::Max(Item.Index, Item.OldIndex));
+		}
+	}
+	if (NumRelocated == 0)
+	{
+		return;
+	}
+
+	// Removal which preserves order relocates all following instances
+	if (DenseLocalToOriginal.IsEmpty()
+		&& ShouldBeDense(LocalToOriginal.Num() + NumRelocated * 2, FMath::Max(MaxIndex, MaxRelocated)))
+	{
+		MakeDense();
+	}
+
+	if (!DenseLocalToOriginal.IsEmpty())
+	{
+		// Swaps are applied in place, then reverse links of touched indices are fixed
+		GrowDense(MaxRelocated + 1);
+		for (const auto& Item: Data)
+		{
+			if (Item.Type == FInstancedStaticMeshDelegates::EInstanceIndexUpdateType::Relocated)
+			{
+				::Swap(DenseLocalToOriginal[Item.OldIndex], DenseLocalToOriginal[Item.Index]);
+			}
+		}
+		for (const auto& Item: Data)
+		{
+			if (Item.Type == FInstancedStaticMeshDelegates::EInstanceIndexUpdateType::Relocated)
+			{
+				DenseOriginalToLocal[DenseLocalToOriginal[Item.OldIndex]] = Item.OldIndex;
+				DenseOriginalToLocal[DenseLocalToOriginal[Item.Index]] = Item.Index;
+			}
+		}
+		return;
+	}
+	
+	// Original indices of touched local indices, permuted by all swaps before the mapping is changed
+	TMap<int32, int32> Moved;
+	Moved.Reserve(NumRelocated * 2);
+	for (const auto& Item: Data)
+	{
+		if (Item.Type != FInstancedStaticMeshDelegates::EInstanceIndexUpdateType::Relocated)
+		{
+			continue;
+		}
+		if (!Moved.Contains(Item.OldIndex))
+		{
+			Moved.Add(Item.OldIndex, ToOriginal(Item.OldIndex));
+		}
+		if (!Moved.Contains(Item.Index))
+		{
+			Moved.Add(Item.Index, ToOriginal(Item.Index));
+		}
+		::Swap(Moved[Item.OldIndex], Moved[Item.Index]);
+	}
+
+	// Touched local indices hold the same set of original ones, so their links are replaced without affecting others
+	for (const auto& [LocalId, _]: Moved)
+	{
+		if (int32 OriginalId; LocalToOriginal.RemoveAndCopyValue(LocalId, OriginalId))
+		{
+			OriginalToLocal.Remove(OriginalId);
+		}
+	}
+	for (const auto& [LocalId, OriginalId]: Moved)
+	{
+		Link(LocalId, OriginalId);
+	}
+}
+
+void ULBBiomesInstanceController::FIndexMapping::Link(int32 LocalId, int32 OriginalId)
+{
+	if (!DenseLocalToOriginal.IsEmpty())
+	{
+		GrowDense(FMath::Max(LocalId, OriginalId) + 1);
+		DenseLocalToOriginal[LocalId] = OriginalId;
+		DenseOriginalToLocal[OriginalId] = LocalId;
+	}
+	else if (LocalId == OriginalId)
+	{
+		LocalToOriginal.Remove(LocalId);
+		OriginalToLocal.Remove(OriginalId);
+	}
+	else
+	{
+		LocalToOriginal.Add(LocalId, OriginalId);
+		OriginalToLocal.Add(OriginalId, LocalId);
+		MaxIndex = FMath::Max(MaxIndex, FMath::Max(LocalId, OriginalId));
+		
+		if (ShouldBeDense(LocalToOriginal.Num(), MaxIndex))
+		{
+			MakeDense();
+		}
+	}
+}
+
+void ULBBiomesInstanceController::FIndexMapping::MakeDense()
+{
+	GrowDense(MaxIndex + 1);
+	for (const auto& [LocalId, OriginalId]: LocalToOriginal)
+	{
+		DenseLocalToOriginal[LocalId] = OriginalId;
+		DenseOriginalToLocal[OriginalId] = LocalId;
+	}
+	LocalToOriginal.Empty();
+	OriginalToLocal.Empty();
+}
+
+void ULBBiomesInstanceController::FIndexMapping::GrowDense(int32 Num)
+{
+	const auto PrevNum = DenseLocalToOriginal.Num();
+	if (Num <= PrevNum)
+	{
+		return;
+	}
+	
+	DenseLocalToOriginal.SetNumUninitialized(Num);
+	DenseOriginalToLocal.SetNumUninitialized(Num);
+	for (int32 i = PrevNum; i < Num; ++i)
+	{
+		DenseLocalToOriginal[i] = i;
+		DenseOriginalToLocal[i] = i;
+	}
+}
+
+int32 ULBBiomesInstanceController::GetOriginalIndex(const UInstancedStaticMeshComponent* Component, int32 InstanceId) const
+{
+	FReadScopeLock Lock(MappingLock);
+	const auto* Mapping = TrackedComponents.Find(Component);
+	return Mapping ? Mapping->ToOriginal(InstanceId) : InstanceId;
+}
+
+void ULBBiomesInstanceController::SetOriginalIndex(const UInstancedStaticMeshComponent* Component, int32 OriginalId,
+	int32 InstanceId)
+{
+	auto& Mapping = Track(Component);
+	
+	FWriteScopeLock Lock(MappingLock);
+	Mapping.Set(InstanceId, OriginalId);
+}
+
+ULBBiomesInstanceController::FIndexMapping& ULBBiomesInstanceController::Track(const UInstancedStaticMeshComponent* Component)
+{
+	check(IsInGameThread());
+	
+	if (auto* Mapping = TrackedComponents.Find(Component))
+	{
+		return *Mapping;
+	}
+	
+	// Components are tracked from the first change made by controller, so all instances have original indices yet
+	LBBiomesTracking::SetTracked(Component, true);
+	FWriteScopeLock Lock(MappingLock);
+	return TrackedComponents.Add(Component);
+}
+
+void ULBBiomesInstanceController::UnTrack(AActor* Actor)
+{
+	if (const auto* ISMs = ISMMapping.Find(Actor))
+	{
+		FWriteScopeLock Lock(MappingLock);
+		for (const auto& [_, Component]: ISMs->Components)
+		{
+			LBBiomesTracking::SetTracked(Component, false);
+			TrackedComponents.Remove(Component.Get());
+		}
+	}
+}
+
+ULBBiomesInstanceController* ULBBiomesInstanceController::GetInstance(const UObject* WorldContext)
+{
+	return WorldContext->GetWorld()->GetSubsystem<ULBBiomesInstanceController>();
+}
+
+FLBBiomesInstanceHandle ULBBiomesInstanceController::RemoveInstance(UInstancedStaticMeshComponent* Component,
+	int32 InstanceId)
+{
+	// Ids of queued requests are valid only for the current state of components
+	FlushPendingRequests();
+	CompleteLoadingPartition(Component->GetOwner());
+	
+	if (!Component->IsValidInstance(InstanceId))
+	{
+		return {};
+	}
+	
+	if (const auto Handle = RemoveInstanceImpl(Component, InstanceId))
+	{
+		ensure(Component->RemoveInstance(InstanceId));
+		return Handle;
+	}
+	return {};
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesInstanceController::RemoveInstances(UInstancedStaticMeshComponent* Component,
+	TConstArrayView<int32> InstanceIds)
+{
+	FlushPendingRequests();
+	CompleteLoadingPartition(Component->GetOwner());
+	
+	TArray<int32> Indices(InstanceIds);
+	Indices.Sort(TGreater<int32>());
+	Indices.SetNum(Algo::Unique(Indices));
+
+	TArray<FLBBiomesInstanceHandle> Handles;
+	Handles.Reserve(Indices.Num());
+
+	// Make handles while all instances are in place, then remove them at once
+	int32 NumRemoved = 0;
+	for (const auto InstanceId: Indices)
+	{
+		if (!Component->IsValidInstance(InstanceId))
+		{
+			continue;
+		}
+		
+		if (const auto Handle = RemoveInstanceImpl(Component, InstanceId))
+		{
+			Handles.Add(Handle);
+			Indices[NumRemoved++] = InstanceId;
+		}
+	}
+	Indices.SetNum(NumRemoved);
+
+	if (!Indices.IsEmpty())
+	{
+		ensure(Component->RemoveInstances(Indices, true));
+	}
+	return Handles;
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesInstanceController::RemoveInstancesInBox(const FBox& Box)
+{
+	return RemoveInstancesInArea(Box, [&Box](const UInstancedStaticMeshComponent* Component)
+	{
+		return Component->GetInstancesOverlappingBox(Box, true);
+	});
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesInstanceController::RemoveInstancesInSphere(const FVector& Center, float Radius)
+{
+	const auto Bounds = FBox(Center - FVector(Radius), Center + FVector(Radius));
+	return RemoveInstancesInArea(Bounds, [&Center, Radius](const UInstancedStaticMeshComponent* Component)
+	{
+		return Component->GetInstancesOverlappingSphere(Center, Radius, true);
+	});
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesInstanceController::RemoveInstancesInArea(const FBox& Bounds,
+	TFunctionRef<TArray<int32>(const UInstancedStaticMeshComponent*)> Query)
+{
+	// Non-partitioned components keep instances in their own actors, partitioned ones - in partition actors
+	TArray<AActor*> Actors;
+	for (const auto& ManagerWeak: Managers)
+	{
+		if (const auto* Manager = ManagerWeak.Get())
+		{
+			Actors.Add(Manager->GetOwner());
+		}
+	}
+	
+	if (const auto* PCG = UPCGSubsystem::GetInstance(GetWorld()))
+	{
+		PCG->ForAllRegisteredIntersectingPartitionActors(Bounds, [&Actors](APCGPartitionActor* Actor)
+		{
+			Actors.Add(Actor);
+		});
+	}
+
+	TArray<FLBBiomesInstanceHandle> Handles;
+	for (auto* Actor: Actors)
+	{
+		if (!ULBBiomesSpawnManager::GetManager(Actor))
+		{
+			continue;
+		}
+		
+		TInlineComponentArray<UInstancedStaticMeshComponent*> Components(Actor);
+		for (auto* Component: Components)
+		{
+			if (!Component->Bounds.GetBox().Intersect(Bounds))
+			{
+				continue;
+			}
+
+			if (const auto Ids = Query(Component); !Ids.IsEmpty())
+			{
+				Handles.Append(RemoveInstances(Component, Ids));
+			}
+		}
+	}
+	return Handles;
+}
+
+bool ULBBiomesInstanceController::RestoreInstanceImpl(const FName& ComponentName, int32 Id, const FTransform& Transform, AActor* Actor)
+{
+	if (UInstancedStaticMeshComponent* Component = FindISM(Actor, ComponentName))
+	{
+		const auto InstanceId = Component->AddInstance(Transform);
+					
+		SetOriginalIndex(Component, Id, InstanceId);
+		UpdateLiveIndex(Component, Id, &Transform);
+					
+		return true;
+	}
+	return false;
+}
+
+bool ULBBiomesInstanceController::RestoreInstance(const FLBBiomesInstanceHandle& InstanceHandle)
+{
+	FlushPendingRequests();
+	
+	FResult Result = {};
+	if (FindDataByHandle(InstanceHandle, Result))
+	{
+		if (Result.Actor)
+		{
+			CompleteLoadingPartition(Result.Actor);
+			
+			const auto* Transform = Result.GetTransform(InstanceHandle.InstanceId);
+			if (!Transform)
+			{
+				UE_LOG(LogBiomes, Warning, TEXT("Instance %d of %s can't be restored: transform is unknown"),
+					InstanceHandle.InstanceId, *InstanceHandle.ComponentName.ToString());
+				return false;
+			}
+			RestoreInstanceImpl(InstanceHandle.ComponentName, InstanceHandle.InstanceId, *Transform, Result.Actor);
+		}
+		
+		Result.Group->Remove(InstanceHandle.ComponentName, InstanceHandle.InstanceId);
+		const auto Packed = InstanceHandle.Pack();
+		RegrowthTimes.Remove(Packed);
+		RemovedIndex.Remove(Packed);
+		AppendJournal(InstanceHandle, false, nullptr);
+		return true;
+	}
+	return false;
+}
+
+void ULBBiomesInstanceController::RestoreInstances(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles)
+{
+	// Queued removals have to be applied before their instances can be restored
+	FlushPendingRequests();
+	
+	TMap<UInstancedStaticMeshComponent*, FAddedInstances> Components;
+
+	for (const auto& Handle: InstanceHandles)
+	{
+		FResult Result = {};
+		if (!FindDataByHandle(Handle, Result))
+		{
+			continue;
+		}
+
+		if (Result.Actor)
+		{
+			CompleteLoadingPartition(Result.Actor);
+			
+			const auto* Transform = Result.GetTransform(Handle.InstanceId);
+			if (!Transform)
+			{
+				UE_LOG(LogBiomes, Warning, TEXT("Instance %d of %s can't be restored: transform is unknown"),
+					Handle.InstanceId, *Handle.ComponentName.ToString());
+				continue;
+			}
+			
+			if (auto* Component = FindISM(Result.Actor, Handle.ComponentName))
+			{
+				auto& Added = Components.FindOrAdd(Component);
+				Added.OriginalIds.Add(Handle.InstanceId);
+				Added.Transforms.Add(*Transform);
+			}
+		}
+		
+		Result.Group->Remove(Handle.ComponentName, Handle.InstanceId);
+		const auto Packed = Handle.Pack();
+		RegrowthTimes.Remove(Packed);
+		RemovedIndex.Remove(Packed);
+		AppendJournal(Handle, false, nullptr);
+	}
+
+	AddInstances(Components);
+}
+
+void ULBBiomesInstanceController::AddInstances(const TMap<UInstancedStaticMeshComponent*, FAddedInstances>& Components)
+{
+	for (const auto& [Component, Added]: Components)
+	{
+		const auto InstanceIds = Component->AddInstances(Added.Transforms, true);
+		
+		auto& Mapping = Track(Component);
+		{
+			FWriteScopeLock Lock(MappingLock);
+			for (int32 i = 0; i < InstanceIds.Num(); ++i)
+			{
+				Mapping.Set(InstanceIds[i], Added.OriginalIds[i]);
+			}
+		}
+		
+		for (int32 i = 0; i < InstanceIds.Num(); ++i)
+		{
+			UpdateLiveIndex(Component, Added.OriginalIds[i], &Added.Transforms[i]);
+		}
+	}
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesInstanceController::HideInstances(UInstancedStaticMeshComponent* Component,
+	TConstArrayView<int32> InstanceIds)
+{
+	FlushPendingRequests();
+	CompleteLoadingPartition(Component->GetOwner());
+	
+	TArray<int32> Indices(InstanceIds);
+	Indices.Sort(TGreater<int32>());
+	Indices.SetNum(Algo::Unique(Indices));
+
+	TArray<FLBBiomesInstanceHandle> Handles;
+	Handles.Reserve(Indices.Num());
+
+	int32 NumHidden = 0;
+	for (const auto InstanceId: Indices)
+	{
+		FTransform Transform;
+		if (!Component->GetInstanceTransform(InstanceId, Transform))
+		{
+			continue;
+		}
+		
+		const auto Handle = MakeHandle(Component, InstanceId);
+		if (!Handle)
+		{
+			continue;
+		}
+
+		Track(Component);
+		HiddenGroups.FindOrAdd(Handle.GroupId).Add(Handle.ComponentName, Handle.InstanceId, &Transform);
+		UpdateLiveIndex(Component, Handle.InstanceId, nullptr);
+		Handles.Add(Handle);
+		Indices[NumHidden++] = InstanceId;
+	}
+	Indices.SetNum(NumHidden);
+
+	if (!Indices.IsEmpty())
+	{
+		ensure(Component->RemoveInstances(Indices, true));
+	}
+	return Handles;
+}
+
+void ULBBiomesInstanceController::ShowInstances(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles)
+{
+	TMap<UInstancedStaticMeshComponent*, FAddedInstances> Components;
+	for (const auto& Handle: InstanceHandles)
+	{
+		auto* Hidden = HiddenGroups.Find(Handle.GroupId);
+		const auto* Instances = Hidden ? Hidden->Components.Find(Handle.ComponentName) : nullptr;
+		const auto* Transform = Instances ? Instances->FindTransform(Handle.InstanceId) : nullptr;
+		if (!Transform)
+		{
+			continue;
+		}
+
+		// Hidden instances are dropped with their actors, so the component is expected to be there
+		auto* Actor = GetGroupActor(Handle.GroupId);
+		if (auto* Component = Actor ? FindISM(Actor, Handle.ComponentName) : nullptr)
+		{
+			auto& Added = Components.FindOrAdd(Component);
+			Added.OriginalIds.Add(Handle.InstanceId);
+			Added.Transforms.Add(*Transform);
+		}
+		
+		Hidden->Remove(Handle.ComponentName, Handle.InstanceId);
+		if (Hidden->IsEmpty())
+		{
+			HiddenGroups.Remove(Handle.GroupId);
+		}
+	}
+
+	AddInstances(Components);
+}
+
+void ULBBiomesInstanceController::RemoveHiddenInstances(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles)
+{
+	for (const auto& Handle: InstanceHandles)
+	{
+		auto* Hidden = HiddenGroups.Find(Handle.GroupId);
+		const auto* Instances = Hidden ? Hidden->Components.Find(Handle.ComponentName) : nullptr;
+		const auto* Transform = Instances ? Instances->FindTransform(Handle.InstanceId) : nullptr;
+		if (!Transform)
+		{
+			continue;
+		}
+
+		auto* Actor = GetGroupActor(Handle.GroupId);
+		if (auto* Component = Actor ? FindISM(Actor, Handle.ComponentName) : nullptr)
+		{
+			RecordRemoval(Component, Handle, *Transform);
+		}
+		
+		Hidden->Remove(Handle.ComponentName, Handle.InstanceId);
+		if (Hidden->IsEmpty())
+		{
+			HiddenGroups.Remove(Handle.GroupId);
+		}
+	}
+}
+
+bool ULBBiomesInstanceController::IsHidden(const FLBBiomesInstanceHandle& InstanceHandle) const
+{
+	const auto* Hidden = HiddenGroups.Find(InstanceHandle.GroupId);
+	return Hidden && Hidden->Contains(InstanceHandle.ComponentName, InstanceHandle.InstanceId);
+}
+
+void ULBBiomesInstanceController::ShowHiddenGroup(int32 GroupId)
+{
+	const auto* Hidden = HiddenGroups.Find(GroupId);
+	if (!Hidden)
+	{
+		return;
+	}
+
+	FBiomesInstances Instances;
+	Hidden->ToInstances(Instances);
+	
+	TArray<FLBBiomesInstanceHandle> Handles;
+	Handles.Reserve(Instances.Num());
+	for (const auto& Item: Instances)
+	{
+		auto& Handle = Handles.AddDefaulted_GetRef();
+		Handle.GroupId = GroupId;
+		Handle.ComponentName = Item.ComponentName;
+		Handle.InstanceId = Item.Id;
+	}
+	
+	ShowInstances(Handles);
+	OnHiddenInstancesReleased.Broadcast();
+}
+
+void ULBBiomesInstanceController::DropHiddenGroup(int32 GroupId)
+{
+	// Content of the actor is gone or regenerated with all instances
+	if (HiddenGroups.Remove(GroupId))
+	{
+		OnHiddenInstancesReleased.Broadcast();
+	}
+}
+
+FLBBiomesInstanceHandle ULBBiomesInstanceController::EnqueueRemoveInstance(UInstancedStaticMeshComponent* Component,
+	int32 InstanceId)
+{
+	check(IsInGameThread());
+	
+	if (!Component || !Component->IsValidInstance(InstanceId))
+	{
+		return {};
+	}
+	
+	const auto Handle = MakeHandle(Component, InstanceId);
+	EnqueueRemoveInstance(Handle);
+	return Handle;
+}
+
+void ULBBiomesInstanceController::EnqueueRemoveInstance(const FLBBiomesInstanceHandle& InstanceHandle)
+{
+	if (InstanceHandle)
+	{
+		PendingRequests.Enqueue({.Type = EPendingRequest::Remove, .Handle = InstanceHandle});
+	}
+}
+
+void ULBBiomesInstanceController::EnqueueRestoreInstance(const FLBBiomesInstanceHandle& InstanceHandle)
+{
+	if (InstanceHandle)
+	{
+		PendingRequests.Enqueue({.Type = EPendingRequest::Restore, .Handle = InstanceHandle});
+	}
+}
+
+void ULBBiomesInstanceController::FlushPendingRequests()
+{
+	check(IsInGameThread());
+	
+	if (FlushingRequests || PendingRequests.IsEmpty())
+	{
+		return;
+	}
+	TGuardValue<bool> Guard(FlushingRequests, true);
+
+	// Requests which came after this point wait for the next flush
+	TArray<FPendingRequest> Requests;
+	FPendingRequest Request;
+	while (PendingRequests.Dequeue(Request))
+	{
+		Requests.Add(Request);
+	}
+
+	// Consecutive requests of the same kind are applied as one batch, so "restore A, remove A" keeps A removed
+	TArray<FLBBiomesInstanceHandle> Batch;
+	for (int32 i = 0; i < Requests.Num(); ++i)
+	{
+		Batch.Add(Requests[i].Handle);
+		if (i + 1 < Requests.Num() && Requests[i + 1].Type == Requests[i].Type)
+		{
+			continue;
+		}
+		
+		if (Requests[i].Type == EPendingRequest::Remove)
+		{
+			ApplyPendingRemovals(Batch);
+		}
+		else
+		{
+			RestoreInstances(Batch);
+		}
+		Batch.Reset();
+	}
+}
+
+void ULBBiomesInstanceController::ApplyPendingRemovals(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles)
+{
+	// Local indices are resolved right before removal, all of them refer to the same state of components
+	TMap<UInstancedStaticMeshComponent*, TArray<int32>> Removals;
+	for (const auto& Handle: InstanceHandles)
+	{
+		int32 InstanceId;
+		if (auto* Component = ResolveInstanceImpl(Handle, InstanceId))
+		{
+			Removals.FindOrAdd(Component).Add(InstanceId);
+		}
+		else
+		{
+			// Already removed, or its actor was unloaded since the request was made
+			UE_LOG(LogBiomes, Verbose, TEXT("Skipped queued removal of instance %d of %s"), Handle.InstanceId,
+				*Handle.ComponentName.ToString());
+		}
+	}
+
+	for (const auto& [Component, Ids]: Removals)
+	{
+		RemoveInstances(Component, Ids);
+	}
+}
+
+void ULBBiomesInstanceController::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+	
+	FlushPendingRequests();
+	ProcessReadingPartitions();
+	ProcessLoadingPartitions();
+	ProcessRegrowth();
+	CompactFullJournal();
+	PublishSnapshot();
+}
+
+TStatId ULBBiomesInstanceController::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(ULBBiomesInstanceController, STATGROUP_Tickables);
+}
+
+bool ULBBiomesInstanceController::FindDataByHandle(const FLBBiomesInstanceHandle& Handle, FResult& Result)
+{
+	if (!Handle)
+	{
+		return false;
+	}
+
+	const auto* PCG = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (!PCG)
+	{
+		return false;
+	}
+
+	if (Handle.GroupId < 0)
+	{
+		const auto MainIndex = -(Handle.GroupId + 1);
+		if (!MainGroups.IsValidIndex(MainIndex))
+		{
+			return false;
+		}
+		auto& Group = MainGroups[MainIndex];
+		auto* Instances = Group.Components.Find(Handle.ComponentName);
+		if (!Instances || !Instances->Contains(Handle.InstanceId))
+		{
+			return false;
+		}
+
+		if (UPCGComponent* Component = FindPcgComponent(GetMainGuid(MainIndex)))
+		{
+			Result.Actor = Component->GetOwner();
+		}
+		Result.Instances = Instances;
+		Result.Group = &Group;
+		return true;
+	}
+
+	const auto PartitionIndex = Handle.GroupId - 1;
+	if (!PartitionGroups.IsValidIndex(PartitionIndex))
+	{
+		return false;
+	}
+	
+	auto& Group = GetGroup(Handle.GroupId);
+	auto* Instances = Group.Components.Find(Handle.ComponentName);
+	if (!Instances || !Instances->Contains(Handle.InstanceId))
+	{
+		return false;
+	}
+
+	const auto Partition = GetPartition(PartitionIndex);
+	Result.Actor = PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false);
+	Result.Instances = Instances;
+	Result.Group = &Group;
+	return true;
+}
+
+bool ULBBiomesInstanceController::GetInstanceTransform(const FLBBiomesInstanceHandle& InstanceHandle, FTransform& InstanceTransform)
+{
+	FResult Result = {};
+	if (FindDataByHandle(InstanceHandle, Result))
+	{
+		if (const auto* Transform = Result.GetTransform(InstanceHandle.InstanceId))
+		{
+			InstanceTransform = *Transform;
+			return true;
+		}
+	}
+	return false;
+}
+
+ULBBiomesInstanceUserData* ULBBiomesInstanceController::GetUserData(const FLBBiomesInstanceHandle& InstanceHandle)
+{
+	FResult Result = {};
+	if (FindDataByHandle(InstanceHandle, Result) && Result.Actor)
+	{
+		if (auto* Manager = ULBBiomesSpawnManager::GetManager(Result.Actor))
+		{
+			// All instances of the component share the same spawn info
+			const auto TagEntry = Manager->GetTagEntry(FindISM(Result.Actor, InstanceHandle.ComponentName));
+			return Manager->GetExtraData(TagEntry.SetIndex, TagEntry.ActorIndex);
+		}
+	}
+	return nullptr;
+}
+
+FLBBiomesInstanceSnapshotPtr ULBBiomesInstanceController::GetSnapshot() const
+{
+	FReadScopeLock Lock(SnapshotLock);
+	return Snapshot;
+}
+
+void ULBBiomesInstanceController::PublishSnapshot()
+{
+	check(IsInGameThread());
+	
+	if (!SnapshotReset && DirtySnapshotGroups.IsEmpty() && DirtySnapshotComponents.IsEmpty())
+	{
+		return;
+	}
+
+	const auto Previous = GetSnapshot();
+	const auto Next = MakeShared<FLBBiomesInstanceSnapshot, ESPMode::ThreadSafe>();
+	Next->Version = Previous->Version + 1;
+
+	auto Update = [this, &Previous, &Next](int32 GroupId, const FInstanceGroup& Group, const TSet<FName>* ChangedComponents)
+	{
+		const auto* PreviousGroup = Previous->Groups.Find(GroupId);
+		if (Group.IsEmpty())
+		{
+			Next->Groups.Remove(GroupId);
+		}
+		else
+		{
+			Next->Groups.Add(GroupId, MakeSnapshotGroup(GroupId, Group, PreviousGroup ? PreviousGroup->Get() : nullptr, ChangedComponents));
+		}
+	};
+	
+	if (SnapshotReset)
+	{
+		for (int32 i = 0; i < MainGroups.Num(); ++i)
+		{
+			Update(-(i + 1), MainGroups[i], nullptr);
+		}
+		for (int32 i = 0; i < PartitionGroups.Num(); ++i)
+		{
+			if (PartitionGroups[i].Resident)
+			{
+				Update(i + 1, PartitionGroups[i], nullptr);
+			}
+		}
+	}
+	else
+	{
+		// Unchanged groups are shared with the previous version
+		Next->Groups = Previous->Groups;
+		
+		auto UpdateDirty = [this, &Update](int32 GroupId, const TSet<FName>* ChangedComponents)
+		{
+			auto& Groups = GroupId < 0 ? MainGroups : PartitionGroups;
+			const int32 Index = FMath::Abs(GroupId) - 1;
+			// Paged out groups are empty, so they are removed
+			if (Groups.IsValidIndex(Index))
+			{
+				Update(GroupId, Groups[Index], ChangedComponents);
+			}
+		};
+		for (const auto GroupId: DirtySnapshotGroups)
+		{
+			UpdateDirty(GroupId, nullptr);
+		}
+		for (const auto& [GroupId, Components]: DirtySnapshotComponents)
+		{
+			if (!DirtySnapshotGroups.Contains(GroupId))
+			{
+				UpdateDirty(GroupId, &Components);
+			}
+		}
+	}
+
+	DirtySnapshotGroups.Reset();
+	DirtySnapshotComponents.Reset();
+	SnapshotReset = false;
+	
+	FWriteScopeLock Lock(SnapshotLock);
+	Snapshot = Next;
+}
+
+FLBBiomesInstanceSnapshot::FGroupPtr ULBBiomesInstanceController::MakeSnapshotGroup(int32 GroupId, const FInstanceGroup& Group,
+	const FLBBiomesInstanceSnapshot::FGroup* Previous, const TSet<FName>* ChangedComponents)
+{
+	const auto Result = MakeShared<FLBBiomesInstanceSnapshot::FGroup, ESPMode::ThreadSafe>();
+	
+	auto* Actor = GetGroupActor(GroupId);
+	const auto* Manager = Actor ? ULBBiomesSpawnManager::GetManager(Actor) : nullptr;
+	
+	for (const auto& [ComponentName, Instances]: Group.Components)
+	{
+		// Handles of the component differ only by instance id
+		const FLBBiomesPackedInstanceHandle ComponentHandle(GroupId, ComponentName, 0);
+		if (!ComponentHandle)
+		{
+			continue;
+		}
+		
+		const auto Key = FLBBiomesInstanceSnapshot::GetComponentKey(ComponentHandle);
+		const auto* PreviousComponent = Previous ? Previous->Components.Find(Key) : nullptr;
+		if (PreviousComponent && ChangedComponents && !ChangedComponents->Contains(ComponentName))
+		{
+			Result->Components.Add(Key, *PreviousComponent);
+			continue;
+		}
+		
+		const auto Component = MakeShared<FLBBiomesInstanceSnapshot::FComponent, ESPMode::ThreadSafe>();
+		Component->Removed = Instances.Removed;
+		Component->Transforms = Instances.Transforms;
+		
+		if (auto* ISM = Manager ? FindISM(Actor, ComponentName) : nullptr)
+		{
+			// All instances of the component share the same spawn info
+			const auto TagEntry = Manager->GetTagEntry(ISM);
+			if (auto* UserData = Manager->GetExtraData(TagEntry.SetIndex, TagEntry.ActorIndex))
+			{
+				SnapshotUserData.Add(UserData);
+				Component->UserData = UserData;
+			}
+		}
+		else if (PreviousComponent)
+		{
+			Component->UserData = (*PreviousComponent)->UserData;
+		}
+		Result->Components.Add(Key, Component);
+	}
+	return Result;
+}
+
+FLBBiomesPersistentInstancesData ULBBiomesInstanceController::GetPersistentData() const
+{
+	FReadScopeLock Lock(GroupsLock);
+	
+	TArray<FLBBiomesPersistentMainInstances> MainData;
+	MainData.Reserve(MainGroups.Num());
+	for (int32 i = 0; i < MainGroups.Num(); ++i)
+	{
+		if (!MainGroups[i].IsEmpty())
+		{
+			auto& Item = MainData.Add_GetRef({.Guid = Mains[i]});
+			MainGroups[i].ToInstances(Item.Instances);
+		}
+	}
+
+	// Partitions are saved to the store as separate chunks
+	TArray<FLBBiomesPersistentPartitionedInstances> PartitionedData;
+	PartitionedData.Reserve(PartitionStore ? 0 : PartitionGroups.Num());
+	for (int32 i = 0; i < PartitionGroups.Num() && !PartitionStore; ++i)
+	{
+		if (!PartitionGroups[i].IsEmpty())
+		{
+			auto& Item = PartitionedData.Add_GetRef({.Partition = Partitions[i]});
+			PartitionGroups[i].ToInstances(Item.Instances);
+		}
+	}
+
+	TArray<FLBBiomesRegrowth> Regrowth;
+	GetRegrowth(Regrowth);
+
+	return {
+		.Mains = Mains,
+		.Partitions = Partitions,
+		.MainInstances = MoveTemp(MainData),
+		.PartitionedInstances = MoveTemp(PartitionedData),
+		.Regrowth = MoveTemp(Regrowth)
+	};
+}
+
+void ULBBiomesInstanceController::SetPersistentData(const FLBBiomesPersistentInstancesData& Data)
+{
+	FlushPendingRequests();
+	
+	// Group indices are rebuilt below
+	while (!ReadingPartitions.IsEmpty())
+	{
+		if (auto* Actor = ReadingPartitions.Pop().Get())
+		{
+			StartLoadingPartition(Actor);
+		}
+	}
+	while (!LoadingPartitions.IsEmpty())
+	{
+		CompleteLoadingPartition(LoadingPartitions.Last()->Actor.Get());
+	}
+	
+	// Progress which wasn't saved is replaced by the data
+	StagedChunks.Reset();
+	// Group ids are not stable between data sets
+	UniqueMeshes.Reset();
+	
+	// Indices of hidden instances are not known to the diff
+	TArray<int32> HiddenGroupIds;
+	HiddenGroups.GetKeys(HiddenGroupIds);
+	for (const auto GroupId: HiddenGroupIds)
+	{
+		ShowHiddenGroup(GroupId);
+	}
+	
+	const auto* PCG = UPCGSubsystem::GetSubsystemForCurrentWorld();
+
+	TMap<FGuid, FInstanceGroup> IncomingMains;
+	for (const auto& [Guid, Instances] : Data.MainInstances)
+	{
+		IncomingMains.FindOrAdd(Guid).Reset(Instances);
+	}
+
+	TMap<FLBBiomesPartition, FInstanceGroup> IncomingPartitions;
+	for (const auto& [Partition, Instances] : Data.PartitionedInstances)
+	{
+		IncomingPartitions.FindOrAdd(Partition).Reset(Instances);
+	}
+
+	if (PartitionStore && PCG)
+	{
+		// Loaded partitions which are not in the data take their state from the store
+		ChunkWrites.Wait();
+		for (const auto& Partition : Data.Partitions)
+		{
+			FInstanceGroup Group;
+			if (!IncomingPartitions.Contains(Partition)
+				&& PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false)
+				&& ReadChunk(PartitionStore, Partition, Group))
+			{
+				IncomingPartitions.Add(Partition, MoveTemp(Group));
+			}
+		}
+	}
+
+	// Touch only instances which differ between current and new state. Usually they are almost the same
+	FInstanceGroup None;
+	for (int32 i = 0; i < MainGroups.Num(); ++i)
+	{
+		const auto Guid = GetMainGuid(i);
+		if (MainGroups[i].IsEmpty() && !IncomingMains.Contains(Guid))
+		{
+			continue;
+		}
+		
+		if (const auto* Component = FindPcgComponent(Guid))
+		{
+			// Instances which can't be restored stay in the incoming group
+			ApplyGroupDiff(Component->GetOwner(), MainGroups[i], IncomingMains.FindOrAdd(Guid));
+		}
+	}
+	
+	for (auto& [Guid, Incoming] : IncomingMains)
+	{
+		// Applied above if the group exists
+		if (!MainGroups.IsValidIndex(FindMainIndex(Guid)))
+		{
+			if (const auto* Component = FindPcgComponent(Guid))
+			{
+				ApplyGroupDiff(Component->GetOwner(), None, Incoming);
+			}
+		}
+	}
+
+	if (PCG)
+	{
+		for (int32 i = 0; i < PartitionGroups.Num(); ++i)
+		{
+			const auto Partition = GetPartition(i);
+			// Groups of loaded partitions are always resident
+			if ((PartitionGroups[i].IsEmpty() && !IncomingPartitions.Contains(Partition)) || !PartitionGroups[i].Resident)
+			{
+				continue;
+			}
+
+			if (auto* Actor = PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false))
+			{
+				ApplyGroupDiff(Actor, PartitionGroups[i], IncomingPartitions.FindOrAdd(Partition));
+			}
+		}
+		
+		for (auto& [Partition, Incoming] : IncomingPartitions)
+		{
+			if (!PartitionGroups.IsValidIndex(FindPartitionIndex(Partition)))
+			{
+				if (auto* Actor = PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false))
+				{
+					ApplyGroupDiff(Actor, None, Incoming);
+				}
+			}
+		}
+	}
+
+	// Copy new data. Indices of Mains and Partitions are used in handles, so keep them as is
+	{
+		FWriteScopeLock Lock(GroupsLock);
+		
+		Mains.Reset();
+		MainIndices.Reset();
+		for (const auto& Guid : Data.Mains)
+		{
+			AddMain(Guid);
+		}
+
+		Partitions.Reset();
+		PartitionIndices.Reset();
+		for (const auto& Partition : Data.Partitions)
+		{
+			AddPartition(Partition);
+		}
+	}
+	
+	MainGroups.Reset();
+	PartitionGroups.Reset();
+	
+	for (auto& [Guid, Group] : IncomingMains)
+	{
+		GetGroupSlot(-(GetMainIndex(Guid) + 1)) = MoveTemp(Group);
+	}
+
+	// Groups are replaced, so they are not read from the store
+	for (auto& [Partition, Group] : IncomingPartitions)
+	{
+		GetGroupSlot(GetPartitionIndex(Partition.GridCoord, Partition.GridSize) + 1) = MoveTemp(Group);
+	}
+
+	// Keep only loaded partitions in memory
+	if (PartitionStore)
+	{
+		PageOutUnloadedPartitions();
+	}
+
+	RebuildRemovedIndex();
+	
+	// Group ids of the data are the same as the current ones now
+	RegrowthQueue.Reset();
+	RegrowthTimes.Reset();
+	for (const auto& [Handle, Delay] : Data.Regrowth)
+	{
+		ScheduleRegrowth(Handle, Delay);
+	}
+
+	ResetJournal(Data);
+	SnapshotReset = true;
+	OnStateReset.Broadcast();
+}
+
+FLBBiomesInstanceHandle ULBBiomesInstanceController::RemoveInstanceWithRegrowth(UInstancedStaticMeshComponent* Component, int32 InstanceId)
+{
+	const auto Delay = GetRegrowthDelay(Component);
+	const auto Handle = RemoveInstance(Component, InstanceId);
+	if (Handle && Delay > 0.f)
+	{
+		ScheduleRegrowth(Handle, Delay);
+	}
+	return Handle;
+}
+
+void ULBBiomesInstanceController::ScheduleRegrowth(const FLBBiomesInstanceHandle& InstanceHandle, float Delay)
+{
+	if (!InstanceHandle || InstanceHandle.GroupId == 0)
+	{
+		return;
+	}
+	
+	const auto Packed = InstanceHandle.Pack();
+	if (!Packed)
+	{
+		UE_LOG(LogBiomes, Warning, TEXT("Regrowth of instance %d of %s can't be scheduled: handle can't be packed"),
+			InstanceHandle.InstanceId, *InstanceHandle.ComponentName.ToString());
+		return;
+	}
+	
+	// Previous entry of the handle stays in the queue and is skipped when it's due
+	const double Time = GetRegrowthTime() + FMath::Max(Delay, 0.f);
+	RegrowthTimes.Add(Packed, Time);
+	RegrowthQueue.HeapPush({Time, Packed});
+}
+
+void ULBBiomesInstanceController::CancelRegrowth(const FLBBiomesInstanceHandle& InstanceHandle)
+{
+	RegrowthTimes.Remove(InstanceHandle.Pack());
+	if (RegrowthTimes.IsEmpty())
+	{
+		RegrowthQueue.Reset();
+	}
+}
+
+float ULBBiomesInstanceController::GetRegrowthDelay(const UInstancedStaticMeshComponent* Component) const
+{
+	if (const auto* Manager = Component ? ULBBiomesSpawnManager::GetManager(Component->GetOwner()) : nullptr)
+	{
+		const auto TagEntry = Manager->GetTagEntry(Component);
+		return Manager->GetRegrowthDelay(TagEntry.SetIndex, TagEntry.ActorIndex);
+	}
+	return 0.f;
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesInstanceController::FindRemovedInstancesInBox(const FBox& Box) const
+{
+	TArray<FLBBiomesInstanceHandle> Result;
+	RemovedIndex.ForEachInBox(Box, [&Result](const FLBBiomesPackedInstanceHandle& Handle, const FVector&)
+	{
+		Result.Add(Handle.Unpack());
+	});
+	return Result;
+}
+
+TArray<FLBBiomesInstanceHandle> ULBBiomesInstanceController::FindRemovedInstancesInSphere(const FVector& Center, float Radius) const
+{
+	TArray<FLBBiomesInstanceHandle> Result;
+	RemovedIndex.ForEachInSphere(Center, Radius, [&Result](const FLBBiomesPackedInstanceHandle& Handle, const FVector&)
+	{
+		Result.Add(Handle.Unpack());
+	});
+	return Result;
+}
+
+TArray<FLBBiomesInstanceQueryResult> ULBBiomesInstanceController::FindInstancesInSphere(const FVector& Center, float Radius,
+	const FLBBiomesInstanceFilter& Filter)
+{
+	FlushPendingRequests();
+	
+	TArray<FLBBiomesInstanceQueryResult> Results;
+	ForEachLiveIndex(FBox(Center - FVector(Radius), Center + FVector(Radius)), [&](FLiveIndex& Index)
+	{
+		Index.Grid.ForEachInSphere(Center, Radius, [&](const FLiveInstanceKey& Key, const FVector& Location)
+		{
+			const auto* Component = Index.Components.Find(Key.ComponentName);
+			if (Component && MatchesFilter(*Component, Filter))
+			{
+				Results.Add(MakeQueryResult(Index, Key, *Component, Location));
+			}
+		});
+	});
+	return Results;
+}
+
+TArray<FLBBiomesInstanceQueryResult> ULBBiomesInstanceController::FindNearestInstances(const FVector& Location, int32 Count,
+	float MaxDistance, const FLBBiomesInstanceFilter& Filter)
+{
+	if (Count <= 0)
+	{
+		return {};
+	}
+	
+	FlushPendingRequests();
+
+	// Nearest partitions go first, farther ones are skipped when enough instances are found
+	TArray<TPair<double, FLiveIndex*>> Indices;
+	ForEachLiveIndex(FBox(Location - FVector(MaxDistance), Location + FVector(MaxDistance)), [&](FLiveIndex& Index)
+	{
+		Indices.Add({Index.Bounds.ComputeSquaredDistanceToPoint(Location), &Index});
+	});
+	Indices.Sort([](const TPair<double, FLiveIndex*>& A, const TPair<double, FLiveIndex*>& B)
+	{
+		return A.Key < B.Key;
+	});
+
+	// Max-heap of the best candidates by squared distance
+	using FCandidate = TPair<double, FLBBiomesInstanceQueryResult>;
+	const auto Farther = [](const FCandidate& A, const FCandidate& B) { return A.Key > B.Key; };
+	TArray<FCandidate> Best;
+	double MaxDistanceSquared = FMath::Square(MaxDistance);
+	
+	for (const auto& [DistanceSquared, Index]: Indices)
+	{
+		if (DistanceSquared > MaxDistanceSquared)
+		{
+			break;
+		}
+		
+		Index->Grid.ForEachInSphere(Location, FMath::Sqrt(MaxDistanceSquared), [&](const FLiveInstanceKey& Key, const FVector& InstanceLocation)
+		{
+			const double InstanceDistanceSquared = FVector::DistSquared(Location, InstanceLocation);
+			const auto* Component = Index->Components.Find(Key.ComponentName);
+			if (InstanceDistanceSquared > MaxDistanceSquared || !Component || !MatchesFilter(*Component, Filter))
+			{
+				return;
+			}
+			
+			Best.HeapPush({InstanceDistanceSquared, MakeQueryResult(*Index, Key, *Component, InstanceLocation)}, Farther);
+			if (Best.Num() > Count)
+			{
+				Best.HeapPopDiscard(Farther);
+			}
+			if (Best.Num() == Count)
+			{
+				MaxDistanceSquared = Best.HeapTop().Key;
+			}
+		});
+	}
+
+	Best.Sort([](const FCandidate& A, const FCandidate& B)
+	{
+		return A.Key < B.Key;
+	});
+	
+	TArray<FLBBiomesInstanceQueryResult> Results;
+	Results.Reserve(Best.Num());
+	for (auto& [_, Result]: Best)
+	{
+		Results.Add(MoveTemp(Result));
+	}
+	return Results;
+}
+
+UInstancedStaticMeshComponent* ULBBiomesInstanceController::ResolveInstance(const FLBBiomesInstanceHandle& InstanceHandle, int32& OutInstanceId)
+{
+	FlushPendingRequests();
+	return ResolveInstanceImpl(InstanceHandle, OutInstanceId);
+}
+
+UInstancedStaticMeshComponent* ULBBiomesInstanceController::ResolveInstanceImpl(const FLBBiomesInstanceHandle& InstanceHandle,
+	int32& OutInstanceId)
+{
+	OutInstanceId = INDEX_NONE;
+	
+	auto* Actor = InstanceHandle ? GetGroupActor(InstanceHandle.GroupId) : nullptr;
+	auto* Component = Actor ? FindISM(Actor, InstanceHandle.ComponentName) : nullptr;
+	if (!Component)
+	{
+		return nullptr;
+	}
+	
+	CompleteLoadingPartition(Actor);
+	if (GetGroup(InstanceHandle.GroupId).Contains(InstanceHandle.ComponentName, InstanceHandle.InstanceId)
+		|| IsHidden(InstanceHandle))
+	{
+		return nullptr;
+	}
+
+	const auto* Mapping = TrackedComponents.Find(Component);
+	const auto InstanceId = Mapping ? Mapping->ToLocal(InstanceHandle.InstanceId) : InstanceHandle.InstanceId;
+	if (!Component->IsValidInstance(InstanceId))
+	{
+		return nullptr;
+	}
+	
+	OutInstanceId = InstanceId;
+	return Component;
+}
+
+void ULBBiomesInstanceController::BuildLiveIndex(AActor* Actor, FLiveIndex& Index)
+{
+	// Saved state should be applied to ISM first
+	CompleteLoadingPartition(Actor);
+	
+	Index.Valid = true;
+	Index.Bounds.Init();
+	Index.Components.Reset();
+	Index.Grid.Reset(GetDefault<ULBBiomesRuntimeSettings>()->SpatialIndexCellSize);
+
+	const auto* Manager = ULBBiomesSpawnManager::GetManager(Actor);
+	const auto* PcgComponent = Actor->FindComponentByClass<UPCGComponent>();
+	Index.GroupId = PcgComponent ? GetGroupId(PcgComponent) : 0;
+	if (!Manager || Index.GroupId == 0)
+	{
+		return;
+	}
+
+	for (const auto& [ComponentName, Component]: CachePartition(Actor).Components)
+	{
+		if (!IsValid(Component))
+		{
+			continue;
+		}
+		
+		const auto TagEntry = Manager->GetTagEntry(Component);
+		if (TagEntry.SetIndex == INDEX_NONE)
+		{
+			continue;
+		}
+		
+		auto& Info = Index.Components.Add(ComponentName);
+		Info.SetIndex = TagEntry.SetIndex;
+		Info.ActorIndex = TagEntry.ActorIndex;
+		Info.SetName = Manager->GetSetName(TagEntry.SetIndex);
+		Info.UserData = Manager->GetExtraData(TagEntry.SetIndex, TagEntry.ActorIndex);
+
+		const auto* Mapping = TrackedComponents.Find(Component.Get());
+		const auto& ComponentTransform = Component->GetComponentTransform();
+		for (int32 i = 0; i < Component->GetInstanceCount(); ++i)
+		{
+			FTransform Transform;
+			if (Component->GetInstanceTransform(i, Transform))
+			{
+				const auto Location = ComponentTransform.TransformPosition(Transform.GetLocation());
+				Index.Grid.Add({ComponentName, Mapping ? Mapping->ToOriginal(i) : i}, Location);
+				Index.Bounds += Location;
+			}
+		}
+	}
+}
+
+void ULBBiomesInstanceController::UpdateLiveIndex(UInstancedStaticMeshComponent* Component, int32 OriginalId, const FTransform* Transform)
+{
+	auto* Index = LiveIndices.Find(Component->GetOwner());
+	if (!Index || !Index->Valid)
+	{
+		return;
+	}
+
+	const FLiveInstanceKey Key{Component->GetFName(), OriginalId};
+	if (!Transform)
+	{
+		Index->Grid.Remove(Key);
+		return;
+	}
+
+	if (!Index->Components.Contains(Key.ComponentName))
+	{
+		// Component is new for the index
+		Index->Valid = false;
+		return;
+	}
+	
+	const auto Location = Component->GetComponentTransform().TransformPosition(Transform->GetLocation());
+	Index->Grid.Add(Key, Location);
+	Index->Bounds += Location;
+}
+
+void ULBBiomesInstanceController::InvalidateLiveIndex(AActor* Actor)
+{
+	if (auto* Index = LiveIndices.Find(Actor))
+	{
+		Index->Valid = false;
+	}
+}
+
+void ULBBiomesInstanceController::ForEachLiveIndex(const FBox& Bounds, TFunctionRef<void(FLiveIndex&)> Callback)
+{
+	for (auto It = LiveIndices.CreateIterator(); It; ++It)
+	{
+		auto* Actor = It->Key.Get();
+		if (!Actor)
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+
+		auto& Index = It->Value;
+		if (!Index.Valid)
+		{
+			BuildLiveIndex(Actor, Index);
+		}
+		
+		if (Index.Bounds.IsValid && Index.Bounds.Intersect(Bounds))
+		{
+			Callback(Index);
+		}
+	}
+}
+
+bool ULBBiomesInstanceController::MatchesFilter(const FLiveComponent& Component, const FLBBiomesInstanceFilter& Filter)
+{
+	if (!Filter.SetName.IsNone() && Filter.SetName != Component.SetName)
+	{
+		return false;
+	}
+	
+	if (Filter.UserDataClass)
+	{
+		const auto* UserData = Component.UserData.Get();
+		return UserData && UserData->IsA(Filter.UserDataClass);
+	}
+	return true;
+}
+
+FLBBiomesInstanceQueryResult ULBBiomesInstanceController::MakeQueryResult(const FLiveIndex& Index, const FLiveInstanceKey& Key,
+	const FLiveComponent& Component, const FVector& Location)
+{
+	FLBBiomesInstanceQueryResult Result;
+	Result.Handle.GroupId = Index.GroupId;
+	Result.Handle.ComponentName = Key.ComponentName;
+	Result.Handle.InstanceId = Key.InstanceId;
+	Result.Location = Location;
+	Result.SetIndex = Component.SetIndex;
+	Result.ActorIndex = Component.ActorIndex;
+	Result.UserData = Component.UserData.Get();
+	return Result;
+}
+
+AActor* ULBBiomesInstanceController::GetGroupActor(int32 GroupId)
+{
+	{
+		FReadScopeLock Lock(GroupsLock);
+		if (GroupId == 0 || (GroupId < 0 ? !Mains.IsValidIndex(-(GroupId + 1)) : !Partitions.IsValidIndex(GroupId - 1)))
+		{
+			return nullptr;
+		}
+	}
+	
+	if (GroupId < 0)
+	{
+		const auto* Component = FindPcgComponent(GetMainGuid(-(GroupId + 1)));
+		return Component ? Component->GetOwner() : nullptr;
+	}
+
+	const auto* PCG = UPCGSubsystem::GetSubsystemForCurrentWorld();
+	if (GroupId > 0 && PCG)
+	{
+		const auto Partition = GetPartition(GroupId - 1);
+		return PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false);
+	}
+	return nullptr;
+}
+
+void ULBBiomesInstanceController::IndexGroup(int32 GroupId, const FInstanceGroup& Group, bool Add)
+{
+	auto* Actor = Add ? GetGroupActor(GroupId) : nullptr;
+	
+	// Only instances with transforms are indexed
+	for (const auto& [ComponentName, Instances]: Group.Components)
+	{
+		if (!Add)
+		{
+			// Transforms might be dropped since the group was indexed
+			for (TConstSetBitIterator<> It(Instances.Removed); It; ++It)
+			{
+				RemovedIndex.Remove(FLBBiomesPackedInstanceHandle(GroupId, ComponentName, It.GetIndex()));
+			}
+			continue;
+		}
+		
+		// Transforms are relative to components, so they are needed to get locations
+		const auto* ComponentTransform = FindComponentTransform(GroupId, ComponentName, Actor ? FindISM(Actor, ComponentName) : nullptr);
+		if (!ComponentTransform)
+		{
+			continue;
+		}
+		
+		for (const auto& [Id, Transform]: Instances.Transforms)
+		{
+			if (const FLBBiomesPackedInstanceHandle Handle(GroupId, ComponentName, Id); Handle)
+			{
+				RemovedIndex.Add(Handle, ComponentTransform->TransformPosition(Transform.GetLocation()));
+			}
+		}
+	}
+}
+
+const FTransform* ULBBiomesInstanceController::FindComponentTransform(int32 GroupId, const FName& ComponentName,
+	const UInstancedStaticMeshComponent* Component)
+{
+	FGuid Main;
+	FLBBiomesPartition Partition;
+	if (!GetGroupKey(GroupId, Main, Partition))
+	{
+		return nullptr;
+	}
+	
+	const FComponentKey Key(Main, Partition, ComponentName);
+	if (Component)
+	{
+		// Generated content is placed the same way every time, the latest location is remembered
+		return &ComponentTransforms.Add(Key, Component->GetComponentTransform());
+	}
+	return ComponentTransforms.Find(Key);
+}
+
+void ULBBiomesInstanceController::RebuildRemovedIndex()
+{
+	RemovedIndex.Reset(GetDefault<ULBBiomesRuntimeSettings>()->SpatialIndexCellSize);
+	
+	for (int32 i = 0; i < MainGroups.Num(); ++i)
+	{
+		IndexGroup(-(i + 1), MainGroups[i], true);
+	}
+	for (int32 i = 0; i < PartitionGroups.Num(); ++i)
+	{
+		IndexGroup(i + 1, PartitionGroups[i], true);
+	}
+}
+
+double ULBBiomesInstanceController::GetRegrowthTime() const
+{
+	const auto* World = GetWorld();
+	return World ? World->GetTimeSeconds() : 0.0;
+}
+
+void ULBBiomesInstanceController::ProcessRegrowth()
+{
+	if (RegrowthQueue.IsEmpty())
+	{
+		return;
+	}
+	
+	const auto* Settings = GetDefault<ULBBiomesRuntimeSettings>();
+	const double EndTime = FPlatformTime::Seconds() + Settings->RegrowthBudgetMs / 1000.0;
+	const double Now = GetRegrowthTime();
+
+	// RestoreInstances groups instances by components
+	TArray<FLBBiomesInstanceHandle> Handles;
+	while (!RegrowthQueue.IsEmpty() && RegrowthQueue.HeapTop().Time <= Now)
+	{
+		FRegrowth Item;
+		RegrowthQueue.HeapPop(Item);
+		
+		const auto* Time = RegrowthTimes.Find(Item.Handle);
+		if (!Time || *Time != Item.Time)
+		{
+			continue;
+		}
+		RegrowthTimes.Remove(Item.Handle);
+		Handles.Add(Item.Handle.Unpack());
+
+		if (Handles.Num() >= Settings->RegrowthBatchSize)
+		{
+			RestoreInstances(Handles);
+			Handles.Reset();
+			
+			if (FPlatformTime::Seconds() >= EndTime)
+			{
+				break;
+			}
+		}
+	}
+
+	if (!Handles.IsEmpty())
+	{
+		RestoreInstances(Handles);
+	}
+}
+
+void ULBBiomesInstanceController::GetRegrowth(TArray<FLBBiomesRegrowth>& OutRegrowth) const
+{
+	const double Now = GetRegrowthTime();
+	OutRegrowth.Reserve(OutRegrowth.Num() + RegrowthTimes.Num());
+	for (const auto& [Handle, Time] : RegrowthTimes)
+	{
+		OutRegrowth.Add({.Handle = Handle.Unpack(), .Delay = static_cast<float>(FMath::Max(Time - Now, 0.0))});
+	}
+}
+
+bool ULBBiomesInstanceController::GetJournalTail(int64 SinceSequence, FLBBiomesPersistentJournal& OutJournal) const
+{
+	{
+		FReadScopeLock Lock(GroupsLock);
+		OutJournal.Mains = Mains;
+		OutJournal.Partitions = Partitions;
+	}
+
+	GetRegrowth(OutJournal.Regrowth);
+	if (!Journaling)
+	{
+		return false;
+	}
+
+	// Entries are sorted by sequence
+	const int32 First = Algo::UpperBoundBy(Journal, SinceSequence, &FLBBiomesJournalEntry::Sequence);
+	OutJournal.Entries = TArray<FLBBiomesJournalEntry>(Journal.GetData() + First, Journal.Num() - First);
+	return SinceSequence >= CompactedSequence;
+}
+
+void ULBBiomesInstanceController::ApplyJournal(const FLBBiomesPersistentJournal& InJournal)
+{
+	ApplyJournalEntries(InJournal);
+
+	// Schedule of the journal is the latest one
+	RegrowthQueue.Reset();
+	RegrowthTimes.Reset();
+	for (auto [Handle, Delay] : InJournal.Regrowth)
+	{
+		Handle.GroupId = MapJournalGroupId(InJournal, Handle.GroupId);
+		ScheduleRegrowth(Handle, Delay);
+	}
+}
+
+void ULBBiomesInstanceController::ApplyJournalEntries(const FLBBiomesPersistentJournal& InJournal)
+{
+	FlushPendingRequests();
+	
+	TMap<int32, TArray<const FLBBiomesJournalEntry*>> Entries;
+	for (const auto& Entry : InJournal.Entries)
+	{
+		if (const auto GroupId = MapJournalGroupId(InJournal, Entry.Handle.GroupId))
+		{
+			Entries.FindOrAdd(GroupId).Add(&Entry);
+		}
+	}
+
+	// Chunks of unloaded partitions are read in parallel, they are paged out again below
+	TArray<int32> PagedIn;
+	for (const auto& [GroupId, _] : Entries)
+	{
+		if (GroupId > 0 && PartitionStore && !GetGroupActor(GroupId)
+			&& !(PartitionGroups.IsValidIndex(GroupId - 1) && PartitionGroups[GroupId - 1].Resident))
+		{
+			RequestChunk(GetPartition(GroupId - 1));
+			PagedIn.Add(GroupId - 1);
+		}
+	}
+
+	for (const auto& [GroupId, GroupEntries] : Entries)
+	{
+		auto* Actor = GetGroupActor(GroupId);
+		
+		// Indices of hidden instances are not known to the diff
+		ShowHiddenGroup(GroupId);
+
+		auto& Current = GetGroup(GroupId);
+		FInstanceGroup Incoming = Current;
+		TArray<FLBBiomesInstanceHandle> Restored;
+		for (const auto* Entry : GroupEntries)
+		{
+			auto Handle = Entry->Handle;
+			Handle.GroupId = GroupId;
+			if (Entry->Removed)
+			{
+				if (!Incoming.Contains(Handle.ComponentName, Handle.InstanceId))
+				{
+					const auto* Transform = Entry->HasTransform ? &Entry->Transform : nullptr;
+					Incoming.Add(Handle.ComponentName, Handle.InstanceId, Transform);
+					AppendJournal(Handle, true, Transform);
+				}
+			}
+			else if (Incoming.Remove(Handle.ComponentName, Handle.InstanceId))
+			{
+				Restored.Add(Handle);
+			}
+		}
+
+		if (Actor)
+		{
+			ApplyGroupDiff(Actor, Current, Incoming);
+		}
+		
+		// The diff keeps instances without transforms removed
+		for (const auto& Handle : Restored)
+		{
+			if (!Incoming.Contains(Handle.ComponentName, Handle.InstanceId))
+			{
+				AppendJournal(Handle, false, nullptr);
+			}
+		}
+		IndexGroup(GroupId, Current, false);
+		Current = MoveTemp(Incoming);
+		IndexGroup(GroupId, Current, true);
+	}
+
+	for (const auto Index : PagedIn)
+	{
+		PageOutPartition(Index);
+	}
+}
+
+void ULBBiomesInstanceController::CompactJournal(int64 UpToSequence)
+{
+	WaitForCompaction();
+	
+	const int32 Count = Algo::UpperBoundBy(Journal, UpToSequence, &FLBBiomesJournalEntry::Sequence);
+	if (Count == 0)
+	{
+		return;
+	}
+
+	TArray<FLBBiomesJournalEntry> Entries(Journal.GetData(), Count);
+	Journal.RemoveAt(0, Count);
+	CompactedSequence = Entries.Last().Sequence;
+
+	TArray<FGuid> CurrentMains;
+	TArray<FLBBiomesPartition> CurrentPartitions;
+	{
+		FReadScopeLock Lock(GroupsLock);
+		CurrentMains = Mains;
+		CurrentPartitions = Partitions;
+	}
+
+	CompactionTask = UE::Tasks::Launch(UE_SOURCE_LOCATION,
+		[Base = JournalSnapshot, Entries = MoveTemp(Entries), CurrentMains = MoveTemp(CurrentMains), CurrentPartitions = MoveTemp(CurrentPartitions)]
+		{
+			return MergeJournal(*Base, Entries, CurrentMains, CurrentPartitions);
+		});
+}
+
+int64 ULBBiomesInstanceController::GetJournalSnapshot(FLBBiomesPersistentInstancesData& OutData)
+{
+	if (!Journaling)
+	{
+		return -1;
+	}
+	
+	WaitForCompaction();
+	OutData = JournalSnapshot->Data;
+	return JournalSnapshot->Sequence;
+}
+
+void ULBBiomesInstanceController::AppendJournal(const FLBBiomesInstanceHandle& Handle, bool Removed, const FTransform* RemovedTransform)
+{
+	if (Journaling)
+	{
+		auto& Entry = Journal.AddDefaulted_GetRef();
+		Entry.Sequence = ++JournalSequence;
+		Entry.Handle = Handle;
+		Entry.Removed = Removed;
+		Entry.HasTransform = RemovedTransform != nullptr;
+		if (RemovedTransform)
+		{
+			Entry.Transform = *RemovedTransform;
+		}
+	}
+	
+	DirtySnapshotComponents.FindOrAdd(Handle.GroupId).Add(Handle.ComponentName);
+	OnInstanceChanged.Broadcast(Handle, Removed, RemovedTransform);
+}
+
+int32 ULBBiomesInstanceController::MapJournalGroupId(const FLBBiomesPersistentJournal& InJournal, int32 GroupId)
+{
+	// Group ids of the journal might differ from the current ones
+	if (GroupId < 0 && InJournal.Mains.IsValidIndex(-(GroupId + 1)))
+	{
+		return -(GetMainIndex(InJournal.Mains[-(GroupId + 1)]) + 1);
+	}
+	if (GroupId > 0 && InJournal.Partitions.IsValidIndex(GroupId - 1))
+	{
+		const auto& Partition = InJournal.Partitions[GroupId - 1];
+		return GetPartitionIndex(Partition.GridCoord, Partition.GridSize) + 1;
+	}
+	return 0;
+}
+
+void ULBBiomesInstanceController::ResetJournal(const FLBBiomesPersistentInstancesData& Data)
+{
+	WaitForCompaction();
+	
+	// Sequence keeps growing, so tails made before are not mistaken for new ones
+	Journal.Reset();
+	CompactedSequence = JournalSequence;
+	JournalSnapshot = MakeShared<FJournalSnapshot>();
+	JournalSnapshot->Sequence = JournalSequence;
+	
+	// Snapshot is the only copy of the data kept by the controller, so it's made only when needed
+	Journaling = GetDefault<ULBBiomesRuntimeSettings>()->JournalChanges;
+	if (Journaling)
+	{
+		JournalSnapshot->Data = Data;
+	}
+}
+
+void ULBBiomesInstanceController::CompactFullJournal()
+{
+	// Previous compaction is finished first, so the game thread doesn't wait for it
+	if (Journal.Num() > GetDefault<ULBBiomesRuntimeSettings>()->MaxJournalEntries
+		&& (!CompactionTask.IsValid() || CompactionTask.IsCompleted()))
+	{
+		CompactJournal(JournalSequence);
+	}
+}
+
+void ULBBiomesInstanceController::WaitForCompaction()
+{
+	if (CompactionTask.IsValid())
+	{
+		JournalSnapshot = CompactionTask.GetResult();
+		CompactionTask = {};
+	}
+}
+
+TSharedPtr<ULBBiomesInstanceController::FJournalSnapshot> ULBBiomesInstanceController::MergeJournal(const FJournalSnapshot& Base,
+	TConstArrayView<FLBBiomesJournalEntry> Entries, const TArray<FGuid>& InMains, const TArray<FLBBiomesPartition>& InPartitions)
+{
+	// Indices of the base tables are the same, the current ones might be only extended since then
+	TMap<FGuid, int32> MainIds;
+	for (int32 i = 0; i < InMains.Num(); ++i)
+	{
+		MainIds.Add(InMains[i], -(i + 1));
+	}
+	TMap<FLBBiomesPartition, int32> PartitionIds;
+	for (int32 i = 0; i < InPartitions.Num(); ++i)
+	{
+		PartitionIds.Add(InPartitions[i], i + 1);
+	}
+	
+	TMap<int32, FInstanceGroup> Groups;
+	for (const auto& [Guid, Instances] : Base.Data.MainInstances)
+	{
+		if (const auto* GroupId = MainIds.Find(Guid))
+		{
+			Groups.FindOrAdd(*GroupId).Reset(Instances);
+		}
+	}
+	for (const auto& [Partition, Instances] : Base.Data.PartitionedInstances)
+	{
+		if (const auto* GroupId = PartitionIds.Find(Partition))
+		{
+			Groups.FindOrAdd(*GroupId).Reset(Instances);
+		}
+	}
+
+	for (const auto& Entry : Entries)
+	{
+		auto& Group = Groups.FindOrAdd(Entry.Handle.GroupId);
+		if (Entry.Removed)
+		{
+			Group.Add(Entry.Handle.ComponentName, Entry.Handle.InstanceId, Entry.HasTransform ? &Entry.Transform : nullptr);
+		}
+		else
+		{
+			Group.Remove(Entry.Handle.ComponentName, Entry.Handle.InstanceId);
+		}
+	}
+
+	auto Result = MakeShared<FJournalSnapshot>();
+	Result->Sequence = Entries.IsEmpty() ? Base.Sequence : Entries.Last().Sequence;
+	Result->Data.Mains = InMains;
+	Result->Data.Partitions = InPartitions;
+	for (const auto& [GroupId, Group] : Groups)
+	{
+		if (Group.IsEmpty())
+		{
+			continue;
+		}
+		
+		if (GroupId < 0 && InMains.IsValidIndex(-(GroupId + 1)))
+		{
+			auto& Item = Result->Data.MainInstances.Add_GetRef({.Guid = InMains[-(GroupId + 1)]});
+			Group.ToInstances(Item.Instances);
+		}
+		else if (GroupId > 0 && InPartitions.IsValidIndex(GroupId - 1))
+		{
+			auto& Item = Result->Data.PartitionedInstances.Add_GetRef({.Partition = InPartitions[GroupId - 1]});
+			Group.ToInstances(Item.Instances);
+		}
+	}
+	return Result;
+}
+
+bool ULBBiomesInstanceController::ApplyStateToActor(AActor* Actor, FInstanceGroup& Group)
+{
+	// Actor has just been loaded - all its instances are in place, except those which were filtered out at generation
+	FInstanceGroup Current;
+	for (const auto& [ComponentName, Instances]: Group.Components)
+	{
+		if (Instances.Prefiltered)
+		{
+			Current.Components.Add(ComponentName, Instances);
+		}
+	}
+	return ApplyGroupDiff(Actor, Current, Group);
+}
+
+bool ULBBiomesInstanceController::ApplyGroupDiff(AActor* Actor, const FInstanceGroup& Current, FInstanceGroup& Incoming)
+{
+	// ISM should match the current state
+	CompleteLoadingPartition(Actor);
+	
+	bool Success = true;
+	
+	TArray<FName> RestoredComponents;
+	for (const auto& [ComponentName, Instances]: Current.Components)
+	{
+		if (!Incoming.Components.Contains(ComponentName))
+		{
+			RestoredComponents.Add(ComponentName);
+		}
+	}
+
+	for (auto& [ComponentName, Instances]: Incoming.Components)
+	{
+		if (auto* Component = FindISM(Actor, ComponentName))
+		{
+			Success &= ApplyComponentDiff(Component, Current.Components.Find(ComponentName), &Instances);
+		}
+	}
+
+	for (const auto& ComponentName : RestoredComponents)
+	{
+		if (auto* Component = FindISM(Actor, ComponentName))
+		{
+			// Receives instances which can't be restored
+			auto& Instances = Incoming.Components.Add(ComponentName);
+			Success &= ApplyComponentDiff(Component, Current.Components.Find(ComponentName), &Instances);
+			if (Instances.Num() == 0)
+			{
+				Incoming.Components.Remove(ComponentName);
+			}
+		}
+	}
+
+	// Instances were changed in bulk
+	InvalidateLiveIndex(Actor);
+	return Success;
+}
+
+bool ULBBiomesInstanceController::ApplyComponentDiff(UInstancedStaticMeshComponent* Component,
+	const FRemovedInstances* Current, FRemovedInstances* Incoming)
+{
+	auto& Mapping = Track(Component);
+	if (Incoming)
+	{
+		Incoming->Mesh = FSoftObjectPath(Component->GetStaticMesh());
+	}
+	
+	// Restore instances which are not removed anymore
+	if (Current)
+	{
+		TArray<int32> OriginalIds;
+		TArray<FTransform> Transforms;
+		for (TConstSetBitIterator<> It(Current->Removed); It; ++It)
+		{
+			const auto Id = It.GetIndex();
+			if (Incoming && Incoming->Contains(Id))
+			{
+				continue;
+			}
+			
+			if (const auto* Transform = Current->FindTransform(Id))
+			{
+				OriginalIds.Add(Id);
+				Transforms.Add(*Transform);
+			}
+			else if (Incoming)
+			{
+				// Otherwise the state would claim an instance which is missing in ISM
+				UE_LOG(LogBiomes, Warning, TEXT("Instance %d of %s can't be restored: transform is unknown"),
+					Id, *Component->GetName());
+				Incoming->Add(Id, nullptr);
+			}
+		}
+
+		if (!Transforms.IsEmpty())
+		{
+			const auto InstanceIds = Component->AddInstances(Transforms, true);
+			
+			FWriteScopeLock Lock(MappingLock);
+			for (int32 i = 0; i < InstanceIds.Num(); ++i)
+			{
+				Mapping.Set(InstanceIds[i], OriginalIds[i]);
+			}
+		}
+	}
+
+	if (!Incoming)
+	{
+		return true;
+	}
+	
+	// Remove instances which are not removed yet
+	TArray<int32> Indices;
+	Indices.Reserve(Incoming->Num());
+	for (TConstSetBitIterator<> It(Incoming->Removed); It; ++It)
+	{
+		const auto Id = It.GetIndex();
+		if (Current && Current->Contains(Id))
+		{
+			continue;
+		}
+
+		const auto LocalId = Mapping.ToLocal(Id);
+		
+		// Transforms are lost after removal - take missing ones while instances still exist
+		FTransform Transform;
+		if (!Incoming->FindTransform(Id) && Component->GetInstanceTransform(LocalId, Transform))
+		{
+			Incoming->Transforms.Add(Id, Transform);
+		}
+		Indices.Add(LocalId);
+	}
+
+	if (Indices.IsEmpty())
+	{
+		return true;
+	}
+	
+	Indices.Sort(TGreater<int32>());
+	return Component->RemoveInstances(Indices, true);
+}
+
+void ULBBiomesInstanceController::OnPartitionLoaded(APCGPartitionActor* PartitionActor)
+{
+	if (GetDefault<ULBBiomesRuntimeSettings>()->IndexLiveInstances)
+	{
+		// Built on demand, when saved state is applied
+		LiveIndices.Add(PartitionActor);
+	}
+	
+	OnPartitionLoadStateChanged.Broadcast({PartitionActor->GetGridCoord(), PartitionActor->GetPCGGridSize()}, true);
+	
+	const auto Index = FindPartitionIndex({PartitionActor->GetGridCoord(), PartitionActor->GetPCGGridSize()});
+	if (Index == INDEX_NONE || (!PartitionStore && !PartitionGroups.IsValidIndex(Index)))
+	{
+		return;
+	}
+
+	// Read the chunk without blocking the game thread, the state is applied when it's ready
+	if (PartitionStore && (!PartitionGroups.IsValidIndex(Index) || !PartitionGroups[Index].Resident))
+	{
+		RequestChunk(GetPartition(Index));
+		if (ChunkReads.Contains(GetPartition(Index)))
 		{
-			for (const auto& [Partition, Instances]: PartitionedInstances)
-			{
-				if (auto* Actor = PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false))
-				{
-					for (const auto& InstanceData: Instances)
-					{
-						RestoreInstanceImpl(InstanceData.ComponentName, InstanceData, Actor);
-					}
-				}
-			}
+			ReadingPartitions.AddUnique(PartitionActor);
+			return;
 		}
 	}
 
-	// Copy new data
-	Mains = Data.Mains;
-	Partitions = Data.Partitions;
+	StartLoadingPartition(PartitionActor);
+}
 
-	MainInstances.Empty(Data.MainInstances.Num());
-	for (const auto& [Guid, Instances] : Data.MainInstances)
+void ULBBiomesInstanceController::StartLoadingPartition(APCGPartitionActor* PartitionActor)
+{
+	const auto Index = FindPartitionIndex({PartitionActor->GetGridCoord(), PartitionActor->GetPCGGridSize()});
+	if (Index == INDEX_NONE)
+	{
+		return;
+	}
+	
+	// UserData is known once the actor is loaded
+	DirtySnapshotGroups.Add(Index + 1);
+	
+	auto& Group = GetGroup(Index + 1);
+	if (Group.IsEmpty())
 	{
-		MainInstances.Add(Guid, Instances);
+		return;
 	}
+	
+	CancelLoadingPartition(PartitionActor);
 
-	PartitionedInstances.Empty(Data.PartitionedInstances.Num());
-	for (const auto& [Partition, Instances] : Data.PartitionedInstances)
+	if (GetDefault<ULBBiomesRuntimeSettings>()->PartitionLoadBudgetMs <= 0.f)
 	{
-		PartitionedInstances.Add(Partition, Instances);
+		if (!ApplyStateToActor(PartitionActor, Group))
+		{
+			const auto Coords = PartitionActor->GetGridCoord();
+			UE_LOG(LogBiomes, Warning, TEXT("Failed to restore state of partition: %d, %d, %d. Tried to remove %d instances"),
+				Coords.X, Coords.Y, Coords.Z, Group.Num());
+		}
+		IndexGroup(Index + 1, Group, true);
+		return;
 	}
 
-	// Remove all new instances
-	if (PCG)
+	// Take a snapshot of the state, prepare indices on a worker thread and remove instances later under the budget
+	const auto Partition = MakeShared<FLoadingPartition>();
+	Partition->Actor = PartitionActor;
+	Partition->Location = PartitionActor->GetActorLocation();
+	Partition->GroupId = Index + 1;
+	for (const auto& [ComponentName, Instances]: Group.Components)
 	{
-		for (const auto& [Guid, Instances] : Data.MainInstances)
+		if (Instances.Prefiltered)
 		{
-			if (const auto* Component = FindPcgComponent(Guid))
+			continue;
+		}
+		
+		auto& Work = Partition->Components.AddDefaulted_GetRef();
+		Work.ComponentName = ComponentName;
+		Work.Removed = Instances.Removed;
+		if (const auto* Component = FindISM(PartitionActor, ComponentName))
+		{
+			if (const auto* Mapping = TrackedComponents.Find(Component))
 			{
-				ApplyStateToActor(Component->GetOwner(), Instances, true);
+				Work.Mapping = *Mapping;
 			}
 		}
+	}
+
+	Partition->Task = UE::Tasks::Launch(UE_SOURCE_LOCATION, [Partition]
+	{
+		PrepareLoadingPartition(*Partition);
+	});
+	LoadingPartitions.Add(Partition);
+}
 
-		for (const auto& [Partition, Instances] : Data.PartitionedInstances)
+void ULBBiomesInstanceController::OnPartitionUnloaded(APCGPartitionActor* PartitionActor)
+{
+	if (auto* Actor = Cast<APCGPartitionActor>(PartitionActor))
+	{
+		// Generated content is gone with the actor
+		const auto Index = FindPartitionIndex({Actor->GetGridCoord(), Actor->GetPCGGridSize()});
+		if (PartitionGroups.IsValidIndex(Index))
 		{
-			if (auto* Actor = PCG->GetRegisteredPCGPartitionActor(Partition.GridSize, Partition.GridCoord, false))
+			// Transforms are taken from ISM again when the partition is loaded, unless they are saved
+			const auto KeepTransforms = GetDefault<ULBBiomesRuntimeSettings>()->PersistentTransforms != ELBBiomesPersistentTransforms::None;
+			for (auto& [_, Instances]: PartitionGroups[Index].Components)
 			{
-				ApplyStateToActor(Actor, Instances, true);
+				Instances.Prefiltered = false;
+				if (!KeepTransforms)
+				{
+					Instances.Transforms.Empty();
+				}
 			}
 		}
+		
+		CancelLoadingPartition(Actor);
+		ReadingPartitions.Remove(Actor);
+		DropHiddenGroup(Index + 1);
+		UnTrack(Actor);
+		InvalidateISMList(Actor);
+		LiveIndices.Remove(Actor);
+
+		if (PartitionGroups.IsValidIndex(Index))
+		{
+			PageOutPartition(Index);
+		}
+		
+		OnPartitionLoadStateChanged.Broadcast({Actor->GetGridCoord(), Actor->GetPCGGridSize()}, false);
+	}
+}
+
+bool ULBBiomesInstanceController::GetGroupKey(int32 GroupId, FGuid& OutMain, FLBBiomesPartition& OutPartition) const
+{
+	FReadScopeLock Lock(GroupsLock);
+	
+	OutMain = {};
+	OutPartition = {};
+	if (GroupId < 0 && Mains.IsValidIndex(-(GroupId + 1)))
+	{
+		OutMain = Mains[-(GroupId + 1)];
+		return true;
+	}
+	if (GroupId > 0 && Partitions.IsValidIndex(GroupId - 1))
+	{
+		OutPartition = Partitions[GroupId - 1];
+		return true;
 	}
+	return false;
+}
+
+int32 ULBBiomesInstanceController::GetGroupIdByKey(const FGuid& Main, const FLBBiomesPartition& Partition)
+{
+	return Main.IsValid() ? -(GetMainIndex(Main) + 1) : GetPartitionIndex(Partition.GridCoord, Partition.GridSize) + 1;
 }
 
-struct FInstancesCache
+int32 ULBBiomesInstanceController::GetNumMainGroups() const
 {
-	// Mesh can be destroyed, but Groups used only as a local storage and always cleared before access
-	TMap<FName, TArray<int32>> Groups;
-	ULBBiomesInstanceController::FTrackedComponents GlobalToLocal;
+	FReadScopeLock Lock(GroupsLock);
+	return Mains.Num();
+}
 
-	void Setup(const TArray<FLBBiomesInstanceData>& Instances)
+void ULBBiomesInstanceController::GetRemovedInstances(int32 GroupId, FBiomesInstances& OutInstances)
+{
+	if (GroupId != 0)
 	{
-		// This is not true - the number of meshes will be less then Num()
-		Groups.Empty();
-		
-		for (const auto& Item : Instances)
+		GetGroup(GroupId).ToInstances(OutInstances);
+	}
+}
+
+void ULBBiomesInstanceController::PrepareLoadingPartition(FLoadingPartition& Partition)
+{
+	for (auto& Work: Partition.Components)
+	{
+		Work.Instances.Reserve(Work.Removed.CountSetBits());
+		for (TConstSetBitIterator<> It(Work.Removed); It; ++It)
 		{
-			Groups.FindOrAdd(Item.ComponentName).Add(Item.Id);
+			Work.Instances.Emplace(Work.Mapping.ToLocal(It.GetIndex()), It.GetIndex());
 		}
+		
+		// Reverse order keeps indices of remaining instances valid after each batch
+		Work.Instances.Sort([](const TPair<int32, int32>& A, const TPair<int32, int32>& B)
+		{
+			return A.Key > B.Key;
+		});
+		
+		Work.Removed.Empty();
+		Work.Mapping = {};
+	}
+}
+
+bool ULBBiomesInstanceController::ContinueLoadingPartition(FLoadingPartition& Partition, double EndTime, int32 BatchSize)
+{
+	auto* Actor = Partition.Actor.Get();
+	if (!Actor)
+	{
+		return true;
 	}
 
-	void BuildGlobalToLocal(ULBBiomesInstanceController::FTrackedComponents& TrackedComponents)
+	auto& Group = GetGroup(Partition.GroupId);
+	
+	TArray<int32> Indices;
+	for (; Partition.NextComponent < Partition.Components.Num(); ++Partition.NextComponent)
 	{
-		GlobalToLocal.Empty(TrackedComponents.Num());
+		auto& Work = Partition.Components[Partition.NextComponent];
+		auto* Component = FindISM(Actor, Work.ComponentName);
+		auto* Instances = Group.Components.Find(Work.ComponentName);
+		if (!Component || !Instances)
+		{
+			continue;
+		}
+
+		Track(Component);
+		Instances->Mesh = FSoftObjectPath(Component->GetStaticMesh());
 		
-		for (auto It = TrackedComponents.CreateIterator(); It; ++It)
+		while (Work.NumRemoved < Work.Instances.Num())
 		{
-			// Clear dead items from TrackedComponents
-			if (!It->Key.IsValid())
+			const auto Count = FMath::Min(BatchSize, Work.Instances.Num() - Work.NumRemoved);
+			
+			Indices.Reset(Count);
+			for (const auto& [LocalId, OriginalId]: MakeArrayView(Work.Instances).Slice(Work.NumRemoved, Count))
 			{
-				It.RemoveCurrent();
-				continue;
+				// Transforms are lost after removal - take missing ones while instances still exist
+				FTransform Transform;
+				if (!Instances->FindTransform(OriginalId) && Component->GetInstanceTransform(LocalId, Transform))
+				{
+					Instances->Transforms.Add(OriginalId, Transform);
+				}
+				Indices.Add(LocalId);
 			}
+			
+			Partition.Success &= Component->RemoveInstances(Indices, true);
+			Partition.NumRemoved += Count;
+			Work.NumRemoved += Count;
 
-			auto& [Component, ToGlobal] = *It;
-
-			// Create reverse mapping - from global to local
-			auto& Mapping = GlobalToLocal.FindOrAdd(Component);
-			const auto Count = ToGlobal.Num();
-			// Limit to current count of elements because ToGlobal might have more elements
-			Mapping.SetNumUninitialized(Count, false);
-			for (int i = 0; i < Count; ++i)
+			if (FPlatformTime::Seconds() >= EndTime)
 			{
-				const auto GlobalId = ToGlobal[i];
-				Mapping[GlobalId] = i;
+				return false;
 			}
 		}
 	}
+	return true;
+}
 
-	void ToLocal(UInstancedStaticMeshComponent* Component, TArray<signed int>& Indices)
+void ULBBiomesInstanceController::FinishLoadingPartition(const FLoadingPartition& Partition)
+{
+	// Transforms of instances were taken from ISM
+	IndexGroup(Partition.GroupId, GetGroup(Partition.GroupId), true);
+	
+	if (!Partition.Success)
 	{
-		if (auto* Mapping = GlobalToLocal.Find(Component))
+		if (const auto* Actor = Cast<APCGPartitionActor>(Partition.Actor.Get()))
 		{
-			for (auto& GlobalIndex: Indices)
-			{
-				GlobalIndex = (*Mapping)[GlobalIndex];
-			}
+			const auto Coords = Actor->GetGridCoord();
+			UE_LOG(LogBiomes, Warning, TEXT("Failed to restore state of partition: %d, %d, %d. Tried to remove %d instances"),
+				Coords.X, Coords.Y, Coords.Z, Partition.NumRemoved);
 		}
 	}
-};
+}
 
-bool ULBBiomesInstanceController::ApplyStateToActor(AActor* Actor,
-	const FBiomesInstances& Instances, bool ConvertToLocal)
+void ULBBiomesInstanceController::ProcessLoadingPartitions()
 {
-	auto& ISMs = CachePartition(Actor);
-
-	static FInstancesCache Cache;
-	Cache.Setup(Instances);
-	if (ConvertToLocal)
+	if (LoadingPartitions.IsEmpty())
 	{
-		Cache.BuildGlobalToLocal(TrackedComponents);
+		return;
 	}
+	
+	const auto* Settings = GetDefault<ULBBiomesRuntimeSettings>();
+	const double EndTime = FPlatformTime::Seconds() + Settings->PartitionLoadBudgetMs / 1000.0;
 
-	bool Success = true;
+	// Partitions nearest to the player go first
+	FVector ViewLocation = FVector::ZeroVector;
+	if (const auto* PlayerController = GetWorld()->GetFirstPlayerController())
+	{
+		FRotator ViewRotation;
+		PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+	}
+	LoadingPartitions.Sort([&ViewLocation](const TSharedPtr<FLoadingPartition>& A, const TSharedPtr<FLoadingPartition>& B)
+	{
+		return FVector::DistSquared(A->Location, ViewLocation) < FVector::DistSquared(B->Location, ViewLocation);
+	});
 
-	for (auto& [ComponentName, Indices]: Cache.Groups)
+	for (int32 i = 0; i < LoadingPartitions.Num() && FPlatformTime::Seconds() < EndTime;)
 	{
-		if (auto* Component = FindISM(ComponentName, &ISMs))
+		const auto Partition = LoadingPartitions[i];
+		if (!Partition->Task.IsCompleted())
 		{
-			if (ConvertToLocal)
-			{
-				Cache.ToLocal(Component, Indices);
-			}
-			Indices.Sort(TGreater<int32>());
+			++i;
+			continue;
+		}
 
-			Track(Component);
-			
-			Success &= Component->RemoveInstances(Indices, true);
+		if (!ContinueLoadingPartition(*Partition, EndTime, Settings->PartitionLoadBatchSize))
+		{
+			break;
 		}
+		
+		FinishLoadingPartition(*Partition);
+		LoadingPartitions.RemoveAt(i);
 	}
-	return Success;
 }
 
-void ULBBiomesInstanceController::OnPartitionLoaded(APCGPartitionActor* PartitionActor)
+void ULBBiomesInstanceController::ProcessReadingPartitions()
 {
-	int NumInstances = 0;
-	bool Success = true;
-	if (const auto* Instances = GetInstancesFor(PartitionActor))
+	for (int32 i = 0; i < ReadingPartitions.Num();)
 	{
-		NumInstances += Instances->Num();
-		Success = ApplyStateToActor(PartitionActor, *Instances, false);
+		auto* Actor = ReadingPartitions[i].Get();
+		const auto* Read = Actor ? ChunkReads.Find({Actor->GetGridCoord(), Actor->GetPCGGridSize()}) : nullptr;
+		if (Read && !Read->IsCompleted())
+		{
+			++i;
+			continue;
+		}
+
+		ReadingPartitions.RemoveAt(i);
+		if (Actor)
+		{
+			StartLoadingPartition(Actor);
+		}
 	}
+}
 
-	if (!Success)
+void ULBBiomesInstanceController::CompleteLoadingPartition(const AActor* Actor)
+{
+	// Saved state is applied to the partition as soon as its chunk is read
+	const auto ReadingIndex = ReadingPartitions.IndexOfByPredicate([Actor](const TWeakObjectPtr<APCGPartitionActor>& Partition)
+	{
+		return Partition.Get() == Actor;
+	});
+	if (Actor && ReadingIndex != INDEX_NONE)
+	{
+		auto* PartitionActor = ReadingPartitions[ReadingIndex].Get();
+		ReadingPartitions.RemoveAt(ReadingIndex);
+		StartLoadingPartition(PartitionActor);
+	}
+	
+	if (LoadingPartitions.IsEmpty())
+	{
+		return;
+	}
+	
+	const auto Index = LoadingPartitions.IndexOfByPredicate([Actor](const TSharedPtr<FLoadingPartition>& Partition)
+	{
+		return Partition->Actor == Actor;
+	});
+	if (Index == INDEX_NONE)
 	{
-		const auto Coords = PartitionActor->GetGridCoord();
-		UE_LOG(LogBiomes, Warning, TEXT("Failed to restore state of partition: %d, %d, %d. Tried to remove %d instances"),
-			Coords.X, Coords.Y, Coords.Z, NumInstances);
+		return;
 	}
+
+	const auto Partition = LoadingPartitions[Index];
+	LoadingPartitions.RemoveAt(Index);
+	
+	Partition->Task.Wait();
+	ContinueLoadingPartition(*Partition, TNumericLimits<double>::Max(), MAX_int32);
+	FinishLoadingPartition(*Partition);
 }
 
-void ULBBiomesInstanceController::OnPartitionUnloaded(APCGPartitionActor* PartitionActor)
+void ULBBiomesInstanceController::CancelLoadingPartition(const AActor* Actor)
 {
-	if (auto* Actor = Cast<APCGPartitionActor>(PartitionActor))
+	// Task holds its own reference to the partition, so it's safe to drop it
+	LoadingPartitions.RemoveAll([Actor](const TSharedPtr<FLoadingPartition>& Partition)
 	{
-		ISMMapping.Remove(Actor);
-	}
+		return Partition->Actor == Actor;
+	});
 }
 
 void ULBBiomesInstanceController::Initialize(FSubsystemCollectionBase& Collection)
@@ -628,69 +3108,277 @@ void ULBBiomesInstanceController::Initialize(FSubsystemCollectionBase& Collectio
 	{
 		DelegateHandle = FInstancedStaticMeshDelegates::OnInstanceIndexUpdated.AddStatic(&ULBBiomesInstanceController::OnInstanceIndexUpdated);
 	}
+
+	RemovedIndex.Reset(GetDefault<ULBBiomesRuntimeSettings>()->SpatialIndexCellSize);
+	Journaling = GetDefault<ULBBiomesRuntimeSettings>()->JournalChanges;
 }
 
 void ULBBiomesInstanceController::Deinitialize()
 {
 	Super::Deinitialize();
 
+	// Unsaved progress is not written to the store
+	LoadingPartitions.Reset();
+	ReadingPartitions.Reset();
+	WaitForChunks();
+	ChunkReads.Reset();
+
 	if (auto* World = GetWorld(); World && World->IsGameWorld())
 	{
 		FInstancedStaticMeshDelegates::OnInstanceIndexUpdated.Remove(DelegateHandle);
 	}
+
+	// Components of non-partitioned PCG components are never untracked by unloading
+	FWriteScopeLock Lock(MappingLock);
+	for (const auto& [Component, _]: TrackedComponents)
+	{
+		if (const auto* Tracked = Component.Get(true))
+		{
+			LBBiomesTracking::SetTracked(Tracked, false);
+		}
+	}
+	TrackedComponents.Reset();
+
+	if (GenerationDoneHandle.IsValid())
+	{
+		if (auto* PCG = UPCGSubsystem::GetInstance(GetWorld()))
+		{
+			PCG->OnComponentGenerationCompleteOrCancelled.Remove(GenerationDoneHandle);
+		}
+	}
 }
 
-void ULBBiomesInstanceController::RegisterManager(ULBBiomesSpawnManager* Manager)
+void ULBBiomesInstanceController::PrefilterGeneration(const UPCGComponent* PcgComponent, const UPCGSettings* Node,
+	TMap<FSoftObjectPath, TBitArray<>>& OutRemoved)
 {
-	Managers.AddUnique(Manager);
+	check(IsInGameThread());
+
+	auto* Owner = PcgComponent->GetOwner();
+	const auto GroupId = Owner ? GetGroupId(PcgComponent) : 0;
+	if (GroupId == 0)
+	{
+		return;
+	}
+	
+	// Finish the previous state first - it's about to be replaced by the new generation
+	CompleteLoadingPartition(Owner);
+	DropHiddenGroup(GroupId);
+	
+	// Generation is watched even if nothing is prefiltered, to learn which meshes are unique
+	FilteringActors.FindOrAdd(Owner);
+	if (!GenerationDoneHandle.IsValid())
+	{
+		if (auto* PCG = UPCGSubsystem::GetInstance(GetWorld()))
+		{
+			GenerationDoneHandle = PCG->OnComponentGenerationCompleteOrCancelled.AddUObject(this, &ULBBiomesInstanceController::OnGenerationDone);
+		}
+	}
+
+	const auto* Unique = UniqueMeshes.Find(GroupId);
+	if (!Unique)
+	{
+		return;
+	}
+	
+	for (auto& [_, Instances]: GetGroup(GroupId).Components)
+	{
+		// Points can be matched to components only by mesh
+		const auto* MeshNode = Instances.Mesh.IsNull() ? nullptr : Unique->Find(Instances.Mesh);
+		if (!MeshNode || *MeshNode != FObjectKey(Node))
+		{
+			continue;
+		}
+		
+		OutRemoved.Add(Instances.Mesh, Instances.Removed);
+		Instances.Prefiltered = true;
+	}
 }
 
-void ULBBiomesInstanceController::UnRegisterManager(ULBBiomesSpawnManager* Manager)
+void ULBBiomesInstanceController::ReportFilteredMeshes(const UPCGComponent* PcgComponent, const UPCGSettings* Node,
+	const TMap<FSoftObjectPath, int32>& NumPoints)
 {
-	Managers.Remove(Manager);
+	check(IsInGameThread());
+	
+	auto* Generation = FilteringActors.Find(PcgComponent->GetOwner());
+	if (!Generation)
+	{
+		return;
+	}
+
+	// Ordinals are counted per node execution, so a mesh seen twice can't be matched, even by the same node
+	for (const auto& [Mesh, Num]: NumPoints)
+	{
+		if (Generation->Nodes.Contains(Mesh))
+		{
+			Generation->Shared.Add(Mesh);
+		}
+		else
+		{
+			Generation->Nodes.Add(Mesh, FObjectKey(Node));
+			Generation->NumPoints.Add(Mesh, Num);
+		}
+	}
 }
 
-UInstancedStaticMeshComponent* ULBBiomesInstanceController::FindISM(const FName& ComponentName, const TArray<TObjectPtr<UInstancedStaticMeshComponent>>* ISMs)
+void ULBBiomesInstanceController::OnGenerationDone(UPCGSubsystem* Subsystem)
 {
-	const auto* Item = ISMs->FindByPredicate([&ComponentName] (const UInstancedStaticMeshComponent* Component)
+	for (auto It = FilteringActors.CreateIterator(); It; ++It)
 	{
-		return ComponentName == Component->GetFName();
-	});
+		auto* Actor = It->Key.Get();
+		if (!Actor)
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+
+		const auto* PcgComponent = Actor->FindComponentByClass<UPCGComponent>();
+		if (!PcgComponent || PcgComponent->IsGenerating())
+		{
+			continue;
+		}
+		const auto Generation = MoveTemp(It->Value);
+		It.RemoveCurrent();
+
+		// Generation has created new components
+		InvalidateISMList(Actor);
+		
+		const auto GroupId = GetGroupId(PcgComponent);
+		if (GroupId == 0)
+		{
+			continue;
+		}
+
+		auto& Group = GetGroup(GroupId);
+		if (!PcgComponent->bGenerated)
+		{
+			// Cancelled, content is incomplete. Removed instances are applied as usual when it's generated again
+			for (auto& [_, Instances]: Group.Components)
+			{
+				Instances.Prefiltered = false;
+			}
+			continue;
+		}
 
-	return Item ? *Item : nullptr;
+		// Mesh is unique if all its instances are in one component and came from one node,
+		// other spawners or nodes after the filter would change the number of instances
+		TMap<FSoftObjectPath, int32> NumInstances;
+		TInlineComponentArray<UInstancedStaticMeshComponent*> Components(Actor);
+		for (const auto* Component: Components)
+		{
+			const FSoftObjectPath Mesh(Component->GetStaticMesh());
+			NumInstances.Add(Mesh, NumInstances.Contains(Mesh) ? INDEX_NONE : Component->GetNumInstances());
+		}
+
+		auto& Unique = UniqueMeshes.FindOrAdd(GroupId);
+		Unique.Reset();
+		for (const auto& [Mesh, Node]: Generation.Nodes)
+		{
+			const auto* Num = NumInstances.Find(Mesh);
+			if (Num && *Num == Generation.NumPoints[Mesh] && !Generation.Shared.Contains(Mesh))
+			{
+				Unique.Add(Mesh, Node);
+			}
+		}
+		
+		for (auto& [ComponentName, Instances]: Group.Components)
+		{
+			if (!Instances.Prefiltered)
+			{
+				continue;
+			}
+			
+			auto* Component = FindISM(Actor, ComponentName);
+			if (!Component || !InstallPrefilteredMapping(Component, Instances))
+			{
+				Instances.Prefiltered = false;
+			}
+		}
+	}
 }
 
-ULBBiomesInstanceController::FBiomesInstances* ULBBiomesInstanceController::GetInstancesFor(const APCGPartitionActor* PartitionActor)
+bool ULBBiomesInstanceController::InstallPrefilteredMapping(UInstancedStaticMeshComponent* Component,
+	const FRemovedInstances& Instances)
 {
-	const auto Size = PartitionActor->GetPCGGridSize();
-	const auto Coords = PartitionActor->GetGridCoord();
+	// Spawned instances keep order of original ones, removed ones are considered to be placed after them
+	const auto NumSpawned = Component->GetNumInstances();
+	const auto NumOriginal = NumSpawned + Instances.Num();
+	if (Instances.Removed.FindLast(true) >= NumOriginal)
+	{
+		UE_LOG(LogBiomes, Warning, TEXT("Generated instances of %s don't match removed ones"), *Component->GetName());
+		return false;
+	}
+
+	LBBiomesTracking::SetTracked(Component, true);
+	FWriteScopeLock Lock(MappingLock);
 	
-	const auto Partition = FLBBiomesPartition{ Coords, Size};
-	return PartitionedInstances.Find(Partition);
+	auto& Mapping = TrackedComponents.Add(Component);
+	int32 NextSpawned = 0;
+	int32 NextRemoved = NumSpawned;
+	for (int32 OriginalId = 0; OriginalId < NumOriginal; ++OriginalId)
+	{
+		const auto LocalId = Instances.Contains(OriginalId) ? NextRemoved++ : NextSpawned++;
+		if (LocalId != OriginalId)
+		{
+			Mapping.Set(LocalId, OriginalId);
+		}
+	}
+	return true;
+}
+
+void ULBBiomesInstanceController::RegisterManager(ULBBiomesSpawnManager* Manager)
+{
+	Managers.AddUnique(Manager);
+}
+
+void ULBBiomesInstanceController::UnRegisterManager(ULBBiomesSpawnManager* Manager)
+{
+	Managers.Remove(Manager);
+}
+
+void ULBBiomesInstanceController::InvalidateISMList(AActor* Actor)
+{
+	ISMMapping.Remove(Actor);
+	InvalidateLiveIndex(Actor);
 }
 
 UInstancedStaticMeshComponent* ULBBiomesInstanceController::FindISM(AActor* Actor, const FName& ComponentName)
 {
-	// Find Actor in cache
-	if (auto* ISMs = ISMMapping.Find(Actor))
+	auto& ISMs = CachePartition(Actor);
+	if (auto* Result = ISMs.Find(ComponentName, Actor))
 	{
-		return FindISM(ComponentName, &ISMs->Components);
+		return Result;
 	}
 
-	// Get a list of all ISM from actor
-	const auto& ISMs = CachePartition(Actor);
-	auto* Result = FindISM(ComponentName, &ISMs);
-	return Result;
+	// Components of the actor were changed since the list was built (regenerated or cleaned up).
+	// Rebuild it, but only once per frame - some names might be missing for real
+	if (ISMs.BuildFrame == GFrameCounter)
+	{
+		return nullptr;
+	}
+	return RebuildISMList(Actor).Find(ComponentName, Actor);
 }
 
-const TArray<TObjectPtr<UInstancedStaticMeshComponent>>& ULBBiomesInstanceController::CachePartition(
-	AActor* Actor)
+FLBBiomesISMList& ULBBiomesInstanceController::CachePartition(AActor* Actor)
 {
-	// Get a list of all ISM from actor
-	TArray<TObjectPtr<UInstancedStaticMeshComponent>> ISMs;
-	Actor->GetComponents(ISMs);
-	
-	// Save it to cache
-	return ISMMapping.Emplace(Actor, FLBBiomesISMList {MoveTemp(ISMs)}).Components;
+	if (auto* ISMs = ISMMapping.Find(Actor))
+	{
+		return *ISMs;
+	}
+	return RebuildISMList(Actor);
 }
 
+FLBBiomesISMList& ULBBiomesInstanceController::RebuildISMList(AActor* Actor)
+{
+	// Get a list of all ISM from actor
+	TInlineComponentArray<UInstancedStaticMeshComponent*> Components(Actor);
+
+	auto& ISMs = ISMMapping.FindOrAdd(Actor);
+	ISMs.Components.Reset();
+	ISMs.Components.Reserve(Components.Num());
+	for (auto* Component: Components)
+	{
+		ISMs.Components.Add(Component->GetFName(), Component);
+	}
+	ISMs.BuildFrame = GFrameCounter;
+	return ISMs;
+}
@@ -0,0 +1,57 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include "Runtime/LBBiomesInstanceSnapshot.h"
+
+bool FLBBiomesInstanceSnapshot::IsRemoved(const FLBBiomesPackedInstanceHandle& Handle) const
+{
+	const auto* Component = FindComponent(Handle);
+	const auto Id = Handle.GetInstanceId();
+	return Component && Component->Removed.IsValidIndex(Id) && Component->Removed[Id];
+}
+
+bool FLBBiomesInstanceSnapshot::GetInstanceTransform(const FLBBiomesPackedInstanceHandle& Handle, FTransform& OutTransform) const
+{
+	const auto* Component = FindComponent(Handle);
+	const auto* Transform = Component ? Component->Transforms.Find(Handle.GetInstanceId()) : nullptr;
+	if (Transform)
+	{
+		OutTransform = *Transform;
+	}
+	return Transform != nullptr;
+}
+
+const ULBBiomesInstanceUserData* FLBBiomesInstanceSnapshot::GetUserData(const FLBBiomesPackedInstanceHandle& Handle) const
+{
+	const auto* Component = FindComponent(Handle);
+	return Component && IsRemoved(Handle) ? Component->UserData : nullptr;
+}
+
+const FLBBiomesInstanceSnapshot::FComponent* FLBBiomesInstanceSnapshot::FindComponent(const FLBBiomesPackedInstanceHandle& Handle) const
+{
+	const auto* Group = Handle ? Groups.Find(Handle.GetGroupId()) : nullptr;
+	const auto* Component = Group ? (*Group)->Components.Find(GetComponentKey(Handle)) : nullptr;
+	return Component ? Component->Get() : nullptr;
+}
@@ -0,0 +1,73 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include "Runtime/LBBiomesPartitionStore.h"
+
+#include "LBBiomesLog.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+ULBBiomesFilePartitionStore* ULBBiomesFilePartitionStore::CreateFilePartitionStore(UObject* Outer, const FString& DirectoryName)
+{
+	auto* Store = NewObject<ULBBiomesFilePartitionStore>(Outer ? Outer : GetTransientPackage());
+	Store->Directory = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("SaveGames"), DirectoryName);
+	return Store;
+}
+
+bool ULBBiomesFilePartitionStore::LoadChunk(const FLBBiomesPartition& Partition, TArray<uint8>& OutData) const
+{
+	const auto Path = GetChunkPath(Partition);
+	if (!IFileManager::Get().FileExists(*Path))
+	{
+		return false;
+	}
+	return FFileHelper::LoadFileToArray(OutData, *Path);
+}
+
+void ULBBiomesFilePartitionStore::SaveChunk(const FLBBiomesPartition& Partition, const TArray<uint8>& Data)
+{
+	const auto Path = GetChunkPath(Partition);
+	if (!FFileHelper::SaveArrayToFile(Data, *Path))
+	{
+		UE_LOG(LogBiomes, Error, TEXT("Failed to save partition chunk: %s"), *Path);
+	}
+}
+
+void ULBBiomesFilePartitionStore::RemoveChunk(const FLBBiomesPartition& Partition)
+{
+	IFileManager::Get().Delete(*GetChunkPath(Partition), false, false, true);
+}
+
+void ULBBiomesFilePartitionStore::Clear()
+{
+	IFileManager::Get().DeleteDirectory(*Directory, false, true);
+}
+
+FString ULBBiomesFilePartitionStore::GetChunkPath(const FLBBiomesPartition& Partition) const
+{
+	return FPaths::Combine(Directory, FString::Printf(TEXT("%u_%d_%d_%d.bin"),
+		Partition.GridSize, Partition.GridCoord.X, Partition.GridCoord.Y, Partition.GridCoord.Z));
+}
@@ -0,0 +1,421 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include "LBBiomesLog.h"
+#include "Runtime/LBBiomesInstanceController.h"
+#include "Runtime/LBBiomesRuntimeSettings.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+/**
+ * Binary format of FLBBiomesPersistentInstancesData:
+ * Header: magic, version, flags, size of uncompressed payload, payload (optionally compressed).
+ * Payload: component names table, then groups. Instances of a group are split by components,
+ * ids of each component are sorted and delta encoded, transforms are optional.
+ */
+namespace LBBiomesPersistentData
+{
+	static constexpr uint32 Magic = 0x4442424C; // LBBD
+
+	enum class EVersion : int32
+	{
+		Initial = 1,
+		Regrowth,
+		// Group ids of handles are 32 bit
+		WideGroups,
+		
+		VersionPlusOne,
+		Latest = VersionPlusOne - 1
+	};
+
+	enum class EFlags : uint8
+	{
+		None = 0,
+		Compressed = 1 << 0
+	};
+	ENUM_CLASS_FLAGS(EFlags)
+
+	using ETransforms = ELBBiomesPersistentTransforms;
+
+	using FNameTable = TMap<FName, int32>;
+
+	void WriteTransform(FArchive& Ar, const FTransform& Transform, ETransforms Mode)
+	{
+		if (Mode == ETransforms::Full)
+		{
+			FTransform Copy = Transform;
+			Ar << Copy;
+			return;
+		}
+
+		FVector3f Location(Transform.GetLocation());
+		FVector3f Scale(Transform.GetScale3D());
+		const auto Rotation = Transform.GetRotation().GetNormalized();
+		int16 Quat[4] = {
+			static_cast<int16>(FMath::RoundToInt(Rotation.X * MAX_int16)),
+			static_cast<int16>(FMath::RoundToInt(Rotation.Y * MAX_int16)),
+			static_cast<int16>(FMath::RoundToInt(Rotation.Z * MAX_int16)),
+			static_cast<int16>(FMath::RoundToInt(Rotation.W * MAX_int16))
+		};
+		Ar << Location << Scale << Quat[0] << Quat[1] << Quat[2] << Quat[3];
+	}
+
+	FTransform ReadTransform(FArchive& Ar, ETransforms Mode)
+	{
+		if (Mode == ETransforms::Full)
+		{
+			FTransform Transform;
+			Ar << Transform;
+			return Transform;
+		}
+
+		FVector3f Location;
+		FVector3f Scale;
+		int16 Quat[4];
+		Ar << Location << Scale << Quat[0] << Quat[1] << Quat[2] << Quat[3];
+
+		const FQuat Rotation = FQuat(Quat[0], Quat[1], Quat[2], Quat[3]).GetNormalized();
+		return FTransform(Rotation, FVector(Location), FVector(Scale));
+	}
+
+	void WriteInstances(FArchive& Ar, const TArray<FLBBiomesInstanceData>& Instances, FNameTable& Names, ETransforms Mode)
+	{
+		TMap<FName, TArray<const FLBBiomesInstanceData*>> Components;
+		for (const auto& Instance: Instances)
+		{
+			Components.FindOrAdd(Instance.ComponentName).Add(&Instance);
+		}
+
+		int32 NumComponents = Components.Num();
+		Ar << NumComponents;
+		
+		for (auto& [ComponentName, Items]: Components)
+		{
+			Items.Sort([](const FLBBiomesInstanceData& A, const FLBBiomesInstanceData& B)
+			{
+				return A.Id < B.Id;
+			});
+			
+			uint32 NameIndex = Names.FindOrAdd(ComponentName, Names.Num());
+			uint32 NumItems = Items.Num();
+			Ar.SerializeIntPacked(NameIndex);
+			Ar.SerializeIntPacked(NumItems);
+
+			int32 PrevId = -1;
+			for (const auto* Item: Items)
+			{
+				uint32 Delta = Item->Id - PrevId;
+				Ar.SerializeIntPacked(Delta);
+				PrevId = Item->Id;
+			}
+
+			uint8 ModeValue = static_cast<uint8>(Mode);
+			Ar << ModeValue;
+			if (Mode == ETransforms::None)
+			{
+				continue;
+			}
+
+			for (const auto* Item: Items)
+			{
+				bool HasTransform = Item->HasTransform;
+				Ar << HasTransform;
+				if (HasTransform)
+				{
+					WriteTransform(Ar, Item->Transform, Mode);
+				}
+			}
+		}
+	}
+
+	void ReadInstances(FArchive& Ar, TArray<FLBBiomesInstanceData>& Instances, const TArray<FName>& Names)
+	{
+		int32 NumComponents = 0;
+		Ar << NumComponents;
+		
+		for (int32 i = 0; i < NumComponents && !Ar.IsError(); ++i)
+		{
+			uint32 NameIndex = 0;
+			uint32 NumItems = 0;
+			Ar.SerializeIntPacked(NameIndex);
+			Ar.SerializeIntPacked(NumItems);
+			if (!Names.IsValidIndex(NameIndex) || NumItems > static_cast<uint32>(Ar.TotalSize()))
+			{
+				Ar.SetError();
+				return;
+			}
+
+			const auto First = Instances.AddDefaulted(NumItems);
+			int32 PrevId = -1;
+			for (uint32 j = 0; j < NumItems; ++j)
+			{
+				uint32 Delta = 0;
+				Ar.SerializeIntPacked(Delta);
+				
+				auto& Item = Instances[First + j];
+				Item.Id = PrevId + Delta;
+				Item.ComponentName = Names[NameIndex];
+				Item.HasTransform = false;
+				PrevId = Item.Id;
+			}
+
+			uint8 ModeValue = 0;
+			Ar << ModeValue;
+			const auto Mode = static_cast<ETransforms>(ModeValue);
+			if (Mode == ETransforms::None)
+			{
+				continue;
+			}
+
+			for (uint32 j = 0; j < NumItems; ++j)
+			{
+				auto& Item = Instances[First + j];
+				Ar << Item.HasTransform;
+				if (Item.HasTransform)
+				{
+					Item.Transform = ReadTransform(Ar, Mode);
+				}
+			}
+		}
+	}
+
+	void WritePayload(FArchive& Ar, FLBBiomesPersistentInstancesData& Data, ETransforms Mode)
+	{
+		// Names are collected while instances are written, so write them to a separate buffer first
+		FNameTable Names;
+		TArray<uint8> Body;
+		FMemoryWriter BodyWriter(Body);
+		
+		BodyWriter << Data.Mains;
+		
+		int32 NumPartitions = Data.Partitions.Num();
+		BodyWriter << NumPartitions;
+		for (auto& Partition: Data.Partitions)
+		{
+			BodyWriter << Partition.GridCoord << Partition.GridSize;
+		}
+
+		int32 NumMainInstances = Data.MainInstances.Num();
+		BodyWriter << NumMainInstances;
+		for (auto& Main: Data.MainInstances)
+		{
+			BodyWriter << Main.Guid;
+			WriteInstances(BodyWriter, Main.Instances, Names, Mode);
+		}
+
+		int32 NumPartitionedInstances = Data.PartitionedInstances.Num();
+		BodyWriter << NumPartitionedInstances;
+		for (auto& Partitioned: Data.PartitionedInstances)
+		{
+			BodyWriter << Partitioned.Partition.GridCoord << Partitioned.Partition.GridSize;
+			WriteInstances(BodyWriter, Partitioned.Instances, Names, Mode);
+		}
+
+		int32 NumRegrowth = Data.Regrowth.Num();
+		BodyWriter << NumRegrowth;
+		for (auto& [Handle, Delay]: Data.Regrowth)
+		{
+			uint32 NameIndex = Names.FindOrAdd(Handle.ComponentName, Names.Num());
+			uint32 InstanceId = Handle.InstanceId;
+			BodyWriter << Handle.GroupId;
+			BodyWriter.SerializeIntPacked(NameIndex);
+			BodyWriter.SerializeIntPacked(InstanceId);
+			BodyWriter << Delay;
+		}
+
+		TArray<FString> NameStrings;
+		NameStrings.SetNum(Names.Num());
+		for (const auto& [Name, Index]: Names)
+		{
+			NameStrings[Index] = Name.ToString();
+		}
+		Ar << NameStrings;
+		Ar.Serialize(Body.GetData(), Body.Num());
+	}
+
+	void ReadPayload(FArchive& Ar, FLBBiomesPersistentInstancesData& Data, int32 Version)
+	{
+		TArray<FString> NameStrings;
+		Ar << NameStrings;
+		
+		TArray<FName> Names;
+		Names.Reserve(NameStrings.Num());
+		for (const auto& NameString: NameStrings)
+		{
+			Names.Add(FName(NameString));
+		}
+
+		Ar << Data.Mains;
+
+		int32 NumPartitions = 0;
+		Ar << NumPartitions;
+		for (int32 i = 0; i < NumPartitions && !Ar.IsError(); ++i)
+		{
+			auto& Partition = Data.Partitions.AddDefaulted_GetRef();
+			Ar << Partition.GridCoord << Partition.GridSize;
+		}
+
+		int32 NumMainInstances = 0;
+		Ar << NumMainInstances;
+		for (int32 i = 0; i < NumMainInstances && !Ar.IsError(); ++i)
+		{
+			auto& Main = Data.MainInstances.AddDefaulted_GetRef();
+			Ar << Main.Guid;
+			ReadInstances(Ar, Main.Instances, Names);
+		}
+
+		int32 NumPartitionedInstances = 0;
+		Ar << NumPartitionedInstances;
+		for (int32 i = 0; i < NumPartitionedInstances && !Ar.IsError(); ++i)
+		{
+			auto& Partitioned = Data.PartitionedInstances.AddDefaulted_GetRef();
+			Ar << Partitioned.Partition.GridCoord << Partitioned.Partition.GridSize;
+			ReadInstances(Ar, Partitioned.Instances, Names);
+		}
+
+		if (Version < static_cast<int32>(EVersion::Regrowth))
+		{
+			return;
+		}
+		
+		int32 NumRegrowth = 0;
+		Ar << NumRegrowth;
+		for (int32 i = 0; i < NumRegrowth && !Ar.IsError(); ++i)
+		{
+			auto& [Handle, Delay] = Data.Regrowth.AddDefaulted_GetRef();
+			uint32 NameIndex = 0;
+			uint32 InstanceId = 0;
+			if (Version < static_cast<int32>(EVersion::WideGroups))
+			{
+				int16 GroupId = 0;
+				Ar << GroupId;
+				Handle.GroupId = GroupId;
+			}
+			else
+			{
+				Ar << Handle.GroupId;
+			}
+			Ar.SerializeIntPacked(NameIndex);
+			Ar.SerializeIntPacked(InstanceId);
+			Ar << Delay;
+			
+			if (!Names.IsValidIndex(NameIndex))
+			{
+				Ar.SetError();
+				return;
+			}
+			Handle.ComponentName = Names[NameIndex];
+			Handle.InstanceId = InstanceId;
+		}
+	}
+}
+
+bool FLBBiomesPersistentInstancesData::Serialize(FArchive& Ar)
+{
+	using namespace LBBiomesPersistentData;
+
+	// Let the engine handle everything except actual saving and loading
+	if (Ar.IsTextFormat() || Ar.IsObjectReferenceCollector() || Ar.IsCountingMemory())
+	{
+		return false;
+	}
+
+	if (Ar.IsLoading())
+	{
+		const auto Start = Ar.Tell();
+		uint32 Header = 0;
+		Ar << Header;
+		if (Header != Magic)
+		{
+			// Saved with tagged properties
+			Ar.Seek(Start);
+			return false;
+		}
+
+		int32 Version = 0;
+		EFlags Flags = EFlags::None;
+		int32 PayloadSize = 0;
+		TArray<uint8> Payload;
+		Ar << Version << Flags << PayloadSize << Payload;
+		
+		if (Version > static_cast<int32>(EVersion::Latest) || PayloadSize < 0)
+		{
+			UE_LOG(LogBiomes, Error, TEXT("Unsupported version of persistent instances data: %d"), Version);
+			Ar.SetError();
+			return true;
+		}
+
+		if (EnumHasAnyFlags(Flags, EFlags::Compressed))
+		{
+			TArray<uint8> Uncompressed;
+			Uncompressed.SetNumUninitialized(PayloadSize);
+			if (!FCompression::UncompressMemory(NAME_Oodle, Uncompressed.GetData(), PayloadSize, Payload.GetData(), Payload.Num()))
+			{
+				UE_LOG(LogBiomes, Error, TEXT("Failed to decompress persistent instances data"));
+				Ar.SetError();
+				return true;
+			}
+			Payload = MoveTemp(Uncompressed);
+		}
+
+		*this = {};
+		FMemoryReader Reader(Payload);
+		ReadPayload(Reader, *this, Version);
+		if (Reader.IsError())
+		{
+			UE_LOG(LogBiomes, Error, TEXT("Persistent instances data is corrupted"));
+			*this = {};
+			Ar.SetError();
+		}
+		return true;
+	}
+
+	const auto* Settings = GetDefault<ULBBiomesRuntimeSettings>();
+	
+	TArray<uint8> Payload;
+	FMemoryWriter Writer(Payload);
+	WritePayload(Writer, *this, Settings->PersistentTransforms);
+
+	int32 Version = static_cast<int32>(EVersion::Latest);
+	EFlags Flags = EFlags::None;
+	int32 PayloadSize = Payload.Num();
+	
+	if (Settings->CompressPersistentData)
+	{
+		int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Oodle, PayloadSize);
+		TArray<uint8> Compressed;
+		Compressed.SetNumUninitialized(CompressedSize);
+		if (FCompression::CompressMemory(NAME_Oodle, Compressed.GetData(), CompressedSize, Payload.GetData(), PayloadSize))
+		{
+			Compressed.SetNum(CompressedSize);
+			Payload = MoveTemp(Compressed);
+			Flags |= EFlags::Compressed;
+		}
+	}
+
+	uint32 Header = Magic;
+	Ar << Header << Version << Flags << PayloadSize << Payload;
+	return true;
+}
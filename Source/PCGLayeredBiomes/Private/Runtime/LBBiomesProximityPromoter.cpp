@@ -0,0 +1,233 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include "Runtime/LBBiomesProximityPromoter.h"
+
+#include "LBBiomesLog.h"
+#include "LBPCGSpawnStructures.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Runtime/LBBiomesActorPool.h"
+#include "Runtime/LBBiomesInstanceController.h"
+#include "Runtime/LBBiomesRuntimeSettings.h"
+
+ULBBiomesProximityPromoter* ULBBiomesProximityPromoter::GetInstance(const UObject* WorldContext)
+{
+	return WorldContext->GetWorld()->GetSubsystem<ULBBiomesProximityPromoter>();
+}
+
+void ULBBiomesProximityPromoter::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+	
+	const auto* Settings = GetDefault<ULBBiomesRuntimeSettings>();
+	Enabled = Settings->AutoPromotion;
+	
+	if (Enabled && !Settings->IndexLiveInstances)
+	{
+		UE_LOG(LogBiomes, Warning, TEXT("AutoPromotion requires IndexLiveInstances in Layered Biomes Runtime settings"));
+	}
+}
+
+void ULBBiomesProximityPromoter::Deinitialize()
+{
+	Super::Deinitialize();
+	
+	Promoted.Reset();
+}
+
+void ULBBiomesProximityPromoter::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	// Without viewpoints everything is demoted
+	TArray<FVector> Viewpoints;
+	if (Enabled)
+	{
+		GetViewpoints(Viewpoints);
+	}
+	
+	DemoteFarActors(Viewpoints);
+	PromoteNearInstances(Viewpoints);
+}
+
+bool ULBBiomesProximityPromoter::IsTickable() const
+{
+	return Enabled || !Promoted.IsEmpty();
+}
+
+TStatId ULBBiomesProximityPromoter::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(ULBBiomesProximityPromoter, STATGROUP_Tickables);
+}
+
+bool ULBBiomesProximityPromoter::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void ULBBiomesProximityPromoter::GetViewpoints(TArray<FVector>& OutViewpoints) const
+{
+	for (auto It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		if (const auto* PlayerController = It->Get())
+		{
+			FVector ViewLocation;
+			FRotator ViewRotation;
+			PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+			OutViewpoints.Add(ViewLocation);
+		}
+	}
+}
+
+void ULBBiomesProximityPromoter::DemoteFarActors(TConstArrayView<FVector> Viewpoints)
+{
+	auto* Pool = ULBBiomesActorPool::GetInstance(this);
+	if (!Pool || Promoted.IsEmpty())
+	{
+		return;
+	}
+	
+	const auto* Settings = GetDefault<ULBBiomesRuntimeSettings>();
+	const double DemotionRadius = FMath::Max(Settings->DemotionRadius, Settings->PromotionRadius);
+	const double DemotionRadiusSquared = FMath::Square(DemotionRadius);
+
+	TArray<TPair<double, FLBBiomesPackedInstanceHandle>> Far;
+	for (auto It = Promoted.CreateIterator(); It; ++It)
+	{
+		// Demoted by gameplay, e.g. the tree was cut down
+		if (!Pool->FindPromotedActor(It->Key))
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+		
+		const double DistanceSquared = GetDistanceSquared(It->Value, Viewpoints);
+		if (DistanceSquared > DemotionRadiusSquared)
+		{
+			Far.Add({DistanceSquared, It->Key});
+		}
+	}
+
+	if (Far.IsEmpty())
+	{
+		return;
+	}
+
+	// Farthest go first
+	Far.Sort([](const TPair<double, FLBBiomesPackedInstanceHandle>& A, const TPair<double, FLBBiomesPackedInstanceHandle>& B)
+	{
+		return A.Key > B.Key;
+	});
+	const int32 Count = FMath::Min(Far.Num(), Settings->MaxDemotionsPerFrame);
+
+	TArray<AActor*> Actors;
+	Actors.Reserve(Count);
+	for (int32 i = 0; i < Count; ++i)
+	{
+		Actors.Add(Pool->FindPromotedActor(Far[i].Value));
+		Promoted.Remove(Far[i].Value);
+	}
+	Pool->DemoteActors(Actors, true);
+}
+
+void ULBBiomesProximityPromoter::PromoteNearInstances(TConstArrayView<FVector> Viewpoints)
+{
+	auto* Pool = ULBBiomesActorPool::GetInstance(this);
+	auto* Controller = ULBBiomesInstanceController::GetInstance(this);
+	if (!Pool || !Controller || Viewpoints.IsEmpty())
+	{
+		return;
+	}
+	
+	const auto* Settings = GetDefault<ULBBiomesRuntimeSettings>();
+
+	// Promoted instances are hidden, so only new candidates are found
+	TMap<FLBBiomesPackedInstanceHandle, double> Candidates;
+	for (const auto& Viewpoint: Viewpoints)
+	{
+		for (const auto& Result: Controller->FindInstancesInSphere(Viewpoint, Settings->PromotionRadius, {}))
+		{
+			if (!Result.UserData || !Result.UserData->ActorClass)
+			{
+				continue;
+			}
+			
+			const auto Handle = Result.Handle.Pack();
+			if (Handle && !Candidates.Contains(Handle))
+			{
+				Candidates.Add(Handle, GetDistanceSquared(Result.Location, Viewpoints));
+			}
+		}
+	}
+
+	if (Candidates.IsEmpty())
+	{
+		return;
+	}
+
+	// Nearest go first
+	Candidates.ValueSort(TLess<double>());
+
+	// Batches per component
+	TMap<UInstancedStaticMeshComponent*, TArray<int32>> Batches;
+	int32 Count = 0;
+	for (const auto& [Handle, DistanceSquared]: Candidates)
+	{
+		if (Count >= Settings->MaxPromotionsPerFrame)
+		{
+			break;
+		}
+		
+		int32 InstanceId = INDEX_NONE;
+		if (auto* Component = Controller->ResolveInstance(Handle.Unpack(), InstanceId))
+		{
+			Batches.FindOrAdd(Component).Add(InstanceId);
+			++Count;
+		}
+	}
+
+	for (const auto& [Component, InstanceIds]: Batches)
+	{
+		for (const auto* Actor: Pool->PromoteInstances(Component, InstanceIds))
+		{
+			if (const auto Handle = Pool->GetPromotedHandle(Actor).Pack())
+			{
+				Promoted.Add(Handle, Actor->GetActorLocation());
+			}
+		}
+	}
+}
+
+double ULBBiomesProximityPromoter::GetDistanceSquared(const FVector& Location, TConstArrayView<FVector> Viewpoints)
+{
+	double Result = TNumericLimits<double>::Max();
+	for (const auto& Viewpoint: Viewpoints)
+	{
+		Result = FMath::Min(Result, FVector::DistSquared(Location, Viewpoint));
+	}
+	return Result;
+}
@@ -0,0 +1,328 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+
+#include "Runtime/LBBiomesReplicationComponent.h"
+
+#include "EngineUtils.h"
+#include "GameFramework/PlayerController.h"
+#include "Grid/PCGPartitionActor.h"
+#include "Net/UnrealNetwork.h"
+
+void FLBBiomesReplicatedInstance::PostReplicatedAdd(const FLBBiomesReplicatedInstances& InArraySerializer)
+{
+	if (InArraySerializer.Owner)
+	{
+		InArraySerializer.Owner->QueueChange(*this, true);
+	}
+}
+
+void FLBBiomesReplicatedInstance::PreReplicatedRemove(const FLBBiomesReplicatedInstances& InArraySerializer)
+{
+	// Items of an unloaded partition are deleted because it was unsubscribed, not because instances were restored
+	if (InArraySerializer.Owner && (Main.IsValid() || InArraySerializer.Owner->LoadedPartitions.Contains(Partition)))
+	{
+		InArraySerializer.Owner->QueueChange(*this, false);
+	}
+}
+
+void FLBBiomesReplicatedInstances::PostReplicatedReceive(const FFastArraySerializer::FPostReplicatedReceiveParameters& Parameters)
+{
+	if (Owner)
+	{
+		Owner->ApplyChanges();
+	}
+}
+
+ULBBiomesReplicationComponent::ULBBiomesReplicationComponent()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+	SetIsReplicatedByDefault(true);
+	
+	Instances.Owner = this;
+}
+
+void ULBBiomesReplicationComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	auto* Controller = GetController();
+	const auto* PlayerController = Cast<APlayerController>(GetOwner());
+	if (!Controller || !PlayerController)
+	{
+		return;
+	}
+
+	if (GetOwnerRole() == ROLE_Authority)
+	{
+		// Listen server host has the state already
+		if (PlayerController->IsLocalController())
+		{
+			return;
+		}
+		
+		InstanceChangedHandle = Controller->OnInstanceChanged.AddUObject(this, &ThisClass::OnInstanceChanged);
+		StateResetHandle = Controller->OnStateReset.AddUObject(this, &ThisClass::OnStateReset);
+		OnStateReset();
+	}
+	else if (PlayerController->IsLocalController())
+	{
+		PartitionHandle = Controller->OnPartitionLoadStateChanged.AddUObject(this, &ThisClass::OnPartitionLoadStateChanged);
+		for (TActorIterator<APCGPartitionActor> It(GetWorld()); It; ++It)
+		{
+			OnPartitionLoadStateChanged({It->GetGridCoord(), It->GetPCGGridSize()}, true);
+		}
+	}
+}
+
+void ULBBiomesReplicationComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (auto* Controller = GetController())
+	{
+		Controller->OnInstanceChanged.Remove(InstanceChangedHandle);
+		Controller->OnStateReset.Remove(StateResetHandle);
+		Controller->OnPartitionLoadStateChanged.Remove(PartitionHandle);
+	}
+	
+	Super::EndPlay(EndPlayReason);
+}
+
+void ULBBiomesReplicationComponent::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME_CONDITION(ULBBiomesReplicationComponent, Instances, COND_OwnerOnly);
+}
+
+void ULBBiomesReplicationComponent::ServerSubscribe_Implementation(const FLBBiomesPartition& Partition)
+{
+	if (auto* Controller = GetController(); Controller && !Subscribed.Contains(Partition))
+	{
+		Subscribed.Add(Partition);
+		AddGroup(Controller->GetGroupIdByKey({}, Partition));
+	}
+}
+
+void ULBBiomesReplicationComponent::ServerUnsubscribe_Implementation(const FLBBiomesPartition& Partition)
+{
+	if (Subscribed.Remove(Partition) > 0)
+	{
+		RemovePartitionItems(Partition);
+	}
+}
+
+void ULBBiomesReplicationComponent::OnInstanceChanged(const FLBBiomesInstanceHandle& Handle, bool Removed, const FTransform* RemovedTransform)
+{
+	FGuid Main;
+	FLBBiomesPartition Partition;
+	const auto* Controller = GetController();
+	if (!Controller || !Controller->GetGroupKey(Handle.GroupId, Main, Partition))
+	{
+		return;
+	}
+	
+	if (!Main.IsValid() && !Subscribed.Contains(Partition))
+	{
+		return;
+	}
+	
+	if (Removed)
+	{
+		AddItem(Main, Partition, Handle, RemovedTransform);
+	}
+	else if (RemoveItem(Handle.Pack()))
+	{
+		Instances.MarkArrayDirty();
+	}
+}
+
+void ULBBiomesReplicationComponent::OnStateReset()
+{
+	Instances.Items.Reset();
+	Instances.MarkArrayDirty();
+	ItemIndices.Reset();
+	PartitionItems.Reset();
+
+	auto* Controller = GetController();
+	if (!Controller)
+	{
+		return;
+	}
+	
+	for (int32 i = 0; i < Controller->GetNumMainGroups(); ++i)
+	{
+		AddGroup(-(i + 1));
+	}
+	for (const auto& Partition: Subscribed)
+	{
+		AddGroup(Controller->GetGroupIdByKey({}, Partition));
+	}
+}
+
+void ULBBiomesReplicationComponent::AddGroup(int32 GroupId)
+{
+	FGuid Main;
+	FLBBiomesPartition Partition;
+	auto* Controller = GetController();
+	if (!Controller || !Controller->GetGroupKey(GroupId, Main, Partition))
+	{
+		return;
+	}
+
+	ULBBiomesInstanceController::FBiomesInstances Removed;
+	Controller->GetRemovedInstances(GroupId, Removed);
+	
+	FLBBiomesInstanceHandle Handle;
+	Handle.GroupId = GroupId;
+	for (const auto& Instance: Removed)
+	{
+		// Instance without transform can't be restored on the client, but it still has to be removed there
+		Handle.ComponentName = Instance.ComponentName;
+		Handle.InstanceId = Instance.Id;
+		AddItem(Main, Partition, Handle, Instance.HasTransform ? &Instance.Transform : nullptr);
+	}
+}
+
+void ULBBiomesReplicationComponent::AddItem(const FGuid& Main, const FLBBiomesPartition& Partition,
+	const FLBBiomesInstanceHandle& Handle, const FTransform* Transform)
+{
+	const auto Packed = Handle.Pack();
+	if (!Packed || ItemIndices.Contains(Packed))
+	{
+		return;
+	}
+
+	const int32 Index = Instances.Items.AddDefaulted();
+	auto& Item = Instances.Items[Index];
+	Item.Main = Main;
+	Item.Partition = Partition;
+	Item.ComponentName = Handle.ComponentName;
+	Item.InstanceId = Handle.InstanceId;
+	Item.HasTransform = Transform != nullptr;
+	if (Transform)
+	{
+		Item.Transform = *Transform;
+	}
+	Item.Handle = Packed;
+	
+	ItemIndices.Add(Packed, Index);
+	if (!Main.IsValid())
+	{
+		PartitionItems.FindOrAdd(Partition).Add(Packed);
+	}
+	Instances.MarkItemDirty(Item);
+}
+
+bool ULBBiomesReplicationComponent::RemoveItem(const FLBBiomesPackedInstanceHandle& Handle)
+{
+	int32 Index = INDEX_NONE;
+	if (!ItemIndices.RemoveAndCopyValue(Handle, Index))
+	{
+		return false;
+	}
+
+	if (const auto& Item = Instances.Items[Index]; !Item.Main.IsValid())
+	{
+		if (auto* Items = PartitionItems.Find(Item.Partition))
+		{
+			Items->Remove(Handle);
+		}
+	}
+
+	Instances.Items.RemoveAtSwap(Index);
+	if (Instances.Items.IsValidIndex(Index))
+	{
+		ItemIndices[Instances.Items[Index].Handle] = Index;
+	}
+	return true;
+}
+
+void ULBBiomesReplicationComponent::RemovePartitionItems(const FLBBiomesPartition& Partition)
+{
+	TSet<FLBBiomesPackedInstanceHandle> Items;
+	if (!PartitionItems.RemoveAndCopyValue(Partition, Items) || Items.IsEmpty())
+	{
+		return;
+	}
+
+	for (const auto& Handle: Items)
+	{
+		RemoveItem(Handle);
+	}
+	Instances.MarkArrayDirty();
+}
+
+void ULBBiomesReplicationComponent::OnPartitionLoadStateChanged(const FLBBiomesPartition& Partition, bool Loaded)
+{
+	if (Loaded)
+	{
+		LoadedPartitions.Add(Partition);
+		ServerSubscribe(Partition);
+	}
+	else
+	{
+		LoadedPartitions.Remove(Partition);
+		ServerUnsubscribe(Partition);
+	}
+}
+
+void ULBBiomesReplicationComponent::QueueChange(const FLBBiomesReplicatedInstance& Item, bool Removed)
+{
+	// Group ids of the journal are indices of its own tables
+	auto& Entry = ReceivedChanges.Entries.AddDefaulted_GetRef();
+	if (Item.Main.IsValid())
+	{
+		Entry.Handle.GroupId = -(ReceivedChanges.Mains.AddUnique(Item.Main) + 1);
+	}
+	else
+	{
+		Entry.Handle.GroupId = ReceivedChanges.Partitions.AddUnique(Item.Partition) + 1;
+	}
+	Entry.Handle.ComponentName = Item.ComponentName;
+	Entry.Handle.InstanceId = Item.InstanceId;
+	Entry.Removed = Removed;
+	Entry.Transform = Item.Transform;
+	Entry.HasTransform = Item.HasTransform;
+}
+
+void ULBBiomesReplicationComponent::ApplyChanges()
+{
+	if (ReceivedChanges.Entries.IsEmpty())
+	{
+		return;
+	}
+
+	// Instances are removed and restored in batches per component
+	if (auto* Controller = GetController())
+	{
+		Controller->ApplyJournalEntries(ReceivedChanges);
+	}
+	ReceivedChanges = {};
+}
+
+ULBBiomesInstanceController* ULBBiomesReplicationComponent::GetController() const
+{
+	const auto* World = GetWorld();
+	return World ? World->GetSubsystem<ULBBiomesInstanceController>() : nullptr;
+}
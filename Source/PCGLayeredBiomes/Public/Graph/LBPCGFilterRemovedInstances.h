@@ -0,0 +1,73 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PCGSettings.h"
+#include "Elements/PCGPointProcessingElementBase.h"
+#include "Metadata/PCGAttributePropertySelector.h"
+#include "LBPCGFilterRemovedInstances.generated.h"
+
+/**
+ * Drop points of instances which were removed at runtime, so they are not spawned at all.
+ * Should be connected directly to Static Mesh Spawner - instances are matched to points by their order for each mesh.
+ */
+UCLASS(BlueprintType, ClassGroup = (Biomes))
+class PCGLAYEREDBIOMES_API ULBPCGFilterRemovedInstancesSettings : public UPCGSettings
+{
+	GENERATED_BODY()
+
+public:
+	ULBPCGFilterRemovedInstancesSettings();
+	
+	//~Begin UPCGSettings interface
+#if WITH_EDITOR
+	virtual FName GetDefaultNodeName() const override { return FName(TEXT("FilterRemovedInstances")); }
+	virtual FText GetDefaultNodeTitle() const override { return NSLOCTEXT("LBPCGFilterRemovedInstancesSettings", "NodeTitle", "Filter Removed Instances"); }
+	virtual FText GetNodeTooltipText() const override { return NSLOCTEXT("LBPCGFilterRemovedInstancesSettings", "NodeTooltip", "Drop points of instances removed at runtime. Connect it directly to Static Mesh Spawner"); }
+	virtual EPCGSettingsType GetType() const override { return EPCGSettingsType::Filter; }
+#endif
+
+protected:
+	virtual TArray<FPCGPinProperties> InputPinProperties() const override;
+	virtual TArray<FPCGPinProperties> OutputPinProperties() const override;
+
+	virtual FPCGElementPtr CreateElement() const override;
+	//~End UPCGSettings interface
+
+public:
+	// Attribute with mesh of the point, the same which is used by mesh selector of the spawner
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Settings, meta = (PCG_Overridable))
+	FPCGAttributePropertyInputSelector MeshAttribute;
+};
+
+class PCGLAYEREDBIOMES_API FLBPCGFilterRemovedInstances final : public FPCGPointProcessingElementBase
+{
+protected:
+	virtual bool ExecuteInternal(FPCGContext* Context) const override;
+	// Result depends on the runtime state of the world
+	virtual bool CanExecuteOnlyOnMainThread(FPCGContext* Context) const override { return true; }
+	virtual bool IsCacheable(const UPCGSettings* InSettings) const override { return false; }
+};
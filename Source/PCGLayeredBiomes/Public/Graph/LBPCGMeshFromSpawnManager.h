@@ -24,10 +24,13 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "PCGContext.h"
 #include "Elements/PCGExecuteBlueprint.h"
 #include "Elements/PCGPointProcessingElementBase.h"
 #include "LBPCGMeshFromSpawnManager.generated.h"
 
+struct FStreamableHandle;
+
 
 /**
  * Various fractal noises that can be used to filter points
@@ -67,8 +70,20 @@ public:
 	FPCGAttributePropertyOutputNoSourceSelector ValueTarget;
 };
 
+struct PCGLAYEREDBIOMES_API FLBPCGMeshFromSpawnManagerContext : public FPCGContext
+{
+	virtual ~FLBPCGMeshFromSpawnManagerContext() override;
+
+	// Meshes of the set are streamed in before the points are processed
+	TSharedPtr<FStreamableHandle> LoadHandle;
+	bool LoadRequested = false;
+};
+
 class PCGLAYEREDBIOMES_API FLBPCGMeshFromSpawnManager : public FPCGPointProcessingElementBase
 {
+public:
+	virtual FPCGContext* Initialize(const FPCGDataCollection& InputData, TWeakObjectPtr<UPCGComponent> SourceComponent, const UPCGNode* Node) override;
+
 protected:
 	virtual bool ExecuteInternal(FPCGContext* Context) const override;
 	virtual bool CanExecuteOnlyOnMainThread(FPCGContext* Context) const override { return true; }
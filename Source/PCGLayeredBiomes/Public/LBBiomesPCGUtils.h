@@ -34,11 +34,15 @@
 #include "LBBiomesPCGUtils.generated.h"
 
 struct FLBBiomesPersistentInstancesData;
+struct FLBBiomesPackedInstanceHandle;
+struct FLBBiomesInstanceFilter;
+struct FLBBiomesInstanceQueryResult;
 
 /**
  * Handle which identify mesh instance across all PCG Components in the world.
  * Can be stored in any place and used after game restart.
  * Invalidates if the world rebuilt with different seed or any changes to config or graphs were made.
+ * Blueprint-friendly form of FLBBiomesPackedInstanceHandle, which should be used for keys of maps and sets.
  */
 USTRUCT(BlueprintType, Category=Biomes)
 struct FLBBiomesInstanceHandle
@@ -50,6 +54,18 @@ struct FLBBiomesInstanceHandle
 	explicit operator bool () const { return IsValid(); }
 
 	bool IsValid() const { return InstanceId != INDEX_NONE && ComponentName != NAME_None; }
+
+	bool operator==(const FLBBiomesInstanceHandle& Other) const
+	{
+		return GroupId == Other.GroupId && InstanceId == Other.InstanceId && ComponentName == Other.ComponentName;
+	}
+
+	friend uint32 GetTypeHash(const FLBBiomesInstanceHandle& Handle)
+	{
+		return HashCombine(HashCombine(GetTypeHash(Handle.GroupId), GetTypeHash(Handle.ComponentName)), GetTypeHash(Handle.InstanceId));
+	}
+
+	FLBBiomesPackedInstanceHandle Pack() const;
 	
 public:
 	/**
@@ -57,9 +73,10 @@ public:
 	 * Zero value is invalid.
 	 * Negative values are indices (-1) of non-partitioned PCG components.
 	 * Positive values are indices (+1) of APCGPartitionActor.
+	 * Was 16 bit, older saves are converted on load.
 	 */
 	UPROPERTY()
-	int16 GroupId = 0;
+	int32 GroupId = 0;
 
 	/**
 	 * ID of the mesh.
@@ -75,6 +92,44 @@ public:
 	int32 InstanceId = INDEX_NONE;
 };
 
+/**
+ * FLBBiomesInstanceHandle packed to 64 bits: 24 bit group, 16 bit index of component name and 24 bit instance id.
+ * Component names are indexed by process-wide table, so packed handles should not be saved - unpack them first.
+ * The table is append-only. Generated components of different actors share names, so it's limited by count
+ * of distinct names (65535), not by count of components. Handles which don't fit are invalid - zero value.
+ */
+struct PCGLAYEREDBIOMES_API FLBBiomesPackedInstanceHandle
+{
+	static constexpr int32 GroupBits = 24;
+	static constexpr int32 ComponentBits = 16;
+	static constexpr int32 InstanceBits = 24;
+	
+	static constexpr int32 MaxGroupId = (1 << (GroupBits - 1)) - 1;
+	static constexpr int32 MaxComponents = 1 << ComponentBits;
+	static constexpr int32 MaxInstanceId = (1 << InstanceBits) - 1;
+
+	FLBBiomesPackedInstanceHandle() = default;
+	
+	/**
+	 * Handle is invalid if any of values doesn't fit.
+	 */
+	FLBBiomesPackedInstanceHandle(int32 GroupId, FName ComponentName, int32 InstanceId);
+	
+	explicit operator bool () const { return IsValid(); }
+	bool IsValid() const { return Value != 0; }
+	
+	int32 GetGroupId() const;
+	FName GetComponentName() const;
+	int32 GetInstanceId() const { return static_cast<int32>(Value & MaxInstanceId); }
+	
+	FLBBiomesInstanceHandle Unpack() const;
+	
+	bool operator==(const FLBBiomesPackedInstanceHandle& Other) const { return Value == Other.Value; }
+	friend uint32 GetTypeHash(const FLBBiomesPackedInstanceHandle& Handle) { return GetTypeHash(Handle.Value); }
+
+	uint64 Value = 0;
+};
+
 /**
  * 
  */
@@ -98,9 +153,79 @@ public:
 	static bool RemoveInstance(UInstancedStaticMeshComponent* Component, const int32 InstanceId,
 		FLBBiomesInstanceHandle& InstanceHandle, FTransform& InstanceTransform);
 
+	/**
+	 * Remove several instances of the component at once.
+	 * @return Handles of removed instances.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static TArray<FLBBiomesInstanceHandle> RemoveInstances(UInstancedStaticMeshComponent* Component, const TArray<int32>& InstanceIds);
+
+	/**
+	 * Remove all biome instances overlapping the box (in world space).
+	 * @return Handles of removed instances.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static TArray<FLBBiomesInstanceHandle> RemoveInstancesInBox(const FBox& Box);
+
+	/**
+	 * Remove all biome instances overlapping the sphere (in world space).
+	 * @return Handles of removed instances.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static TArray<FLBBiomesInstanceHandle> RemoveInstancesInSphere(const FVector& Center, float Radius);
+
 	UFUNCTION(BlueprintCallable, Category=Biomes)
 	static bool RestoreInstance(const FLBBiomesInstanceHandle& InstanceHandle);
 
+	/**
+	 * Remove the instance and restore it after the regrowth delay of its UserData or spawn set.
+	 * @return Handle of removed instance.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static FLBBiomesInstanceHandle RemoveInstanceWithRegrowth(UInstancedStaticMeshComponent* Component, int32 InstanceId);
+
+	/**
+	 * Restore removed instance after the delay in seconds. Replaces previous schedule of the instance.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static void ScheduleRegrowth(const FLBBiomesInstanceHandle& InstanceHandle, float Delay);
+
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static void CancelRegrowth(const FLBBiomesInstanceHandle& InstanceHandle);
+
+	/**
+	 * Return handles of removed instances located in the box (in world space).
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static TArray<FLBBiomesInstanceHandle> FindRemovedInstancesInBox(const FBox& Box);
+
+	/**
+	 * Return handles of removed instances located in the sphere (in world space).
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static TArray<FLBBiomesInstanceHandle> FindRemovedInstancesInSphere(const FVector& Center, float Radius);
+
+	/**
+	 * Return live instances in the sphere (in world space). Requires IndexLiveInstances in runtime settings.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static TArray<FLBBiomesInstanceQueryResult> FindInstancesInSphere(const FVector& Center, float Radius,
+		const FLBBiomesInstanceFilter& Filter);
+
+	/**
+	 * Return up to Count live instances nearest to the Location, sorted by distance.
+	 * Requires IndexLiveInstances in runtime settings.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static TArray<FLBBiomesInstanceQueryResult> FindNearestInstances(const FVector& Location, int32 Count, float MaxDistance,
+		const FLBBiomesInstanceFilter& Filter);
+
+	/**
+	 * Return component and current index of the live instance.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes, meta=(ExpandBoolAsExecs = "ReturnValue"))
+	static bool ResolveInstance(const FLBBiomesInstanceHandle& InstanceHandle, UInstancedStaticMeshComponent*& Component, int32& InstanceId);
+
 	UFUNCTION(BlueprintCallable, Category=Biomes, meta=(ExpandBoolAsExecs = "ReturnValue"))
 	static bool GetTransformByHandle(const FLBBiomesInstanceHandle& InstanceHandle, FTransform& InstanceTransform);
 
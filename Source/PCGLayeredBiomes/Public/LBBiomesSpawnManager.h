@@ -27,6 +27,7 @@
 #include "LBPCGSpawnStructures.h"
 #include "Components/ActorComponent.h"
 #include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StreamableManager.h"
 #include "LBBiomesSpawnManager.generated.h"
 
 
@@ -48,10 +49,21 @@ public:
 	
 	virtual void BeginPlay() override;
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void OnUnregister() override;
+	virtual void BeginDestroy() override;
 	
 	const TArray<FLBPCGSpawnInfo>* FindSet(const FString& SetName) const;
+	const TArray<FLBPCGSpawnInfo>* FindSet(FName SetName) const;
 	const FLBBiomeSettings* FindSettings(FName BiomeName) const;
 
+	/**
+	 * Start async streaming of all meshes of the set.
+	 * Meshes stay resident while the manager exists, so spawners don't need to load them synchronously.
+	 * @param SetName Name of the set to prefetch
+	 * @return Own handle of the caller to wait on or nullptr if all meshes are already loaded
+	 */
+	TSharedPtr<FStreamableHandle> PrefetchSet(const FString& SetName);
+
 	FPCGCrc GetBiomesCrc() const;
 	FSoftObjectPath GetBiomesSoftPath() const;
 
@@ -76,6 +88,9 @@ public:
 	ULBBiomesInstanceUserData* GetExtraDataFromInstance(const UInstancedStaticMeshComponent* Component,
 	                                                  const int32 InstanceId) const;
 	ULBBiomesInstanceUserData* GetExtraData(int32 SetIndex, int32 ActorIndex) const;
+	// Delay of UserData if it's set, otherwise of the spawn set. Zero if instances don't regrow
+	float GetRegrowthDelay(int32 SetIndex, int32 ActorIndex) const;
+	FName GetSetName(int32 SetIndex) const;
 	bool GetSpawnInfoFromInstance(const UInstancedStaticMeshComponent* Component,
 	                                       const int32 InstanceId, FLBPCGSpawnInfo& Result) const;
 	
@@ -88,9 +103,14 @@ public:
 	
 	const FLBPCGSpawnInfo* FindActorInfoByMesh(const TSoftObjectPtr<UStaticMesh>& Mesh, FPackedTagsEntry& OutEntry) const;
 	
+	/**
+	 * All instances of ISM share the same spawn info, so it's stored once per component instead of per instance custom data.
+	 * Resolved by the mesh of the component. Can be called from any thread.
+	 */
+	FPackedTagsEntry GetTagEntry(const UInstancedStaticMeshComponent* Component) const;
+	
 private:
-	static FPackedTagsEntry GetTagEntryFromInstance(const UInstancedStaticMeshComponent* Component, const int32 InstanceId);
-	static void SetTagEntryFromInstance(UInstancedStaticMeshComponent* Component, const int32 InstanceId, const FPackedTagsEntry& Data);
+	FPackedTagsEntry GetTagEntryFromInstance(const UInstancedStaticMeshComponent* Component, const int32 InstanceId) const;
 	
 protected:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category=Biomes, AdvancedDisplay, meta=(EditCondition="false"))
@@ -102,6 +122,23 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category=Biomes)
 	TObjectPtr<ULBBiomesSettings> Biomes;
 	
+	struct FComponentTags
+	{
+		// Mesh the entry was resolved for, entry is resolved again if the mesh is changed
+		TObjectKey<UStaticMesh> Mesh;
+		FPackedTagsEntry Entry;
+	};
+	
+	// Side table of spawn info of ISMs spawned by this manager
+	mutable TMap<TObjectKey<UInstancedStaticMeshComponent>, FComponentTags> ComponentTags;
+	mutable int32 NextComponentTagsPrune = 64;
+	mutable FRWLock ComponentTagsLock;
+	
+	// Keeps meshes of prefetched sets in memory
+	TMap<FString, TSharedPtr<FStreamableHandle>> PrefetchedSets;
+	// Generation in editor prefetches sets too, but there is no EndPlay
+	void ReleasePrefetchedSets();
+	
 	struct FInstancedActor
 	{
 		FSoftObjectPath StaticMesh;
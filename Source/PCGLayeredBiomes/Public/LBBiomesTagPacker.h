@@ -28,7 +28,9 @@
 #include "LBBiomesTagPacker.generated.h"
 
 /**
- * 
+ * Spawn info of instances is resolved once per component by ULBBiomesSpawnManager::GetTagEntry,
+ * so the packer doesn't write any per instance custom data and leaves it free for materials.
+ * Kept for existing graphs.
  */
 UCLASS(BlueprintType, ClassGroup = (Procedural), Category="Biomes")
 class PCGLAYEREDBIOMES_API ULBBiomesTagPacker : public UPCGInstanceDataPackerBase
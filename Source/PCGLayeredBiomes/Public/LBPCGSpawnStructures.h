@@ -24,16 +24,29 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "PCGCrc.h"
 #include "Engine/DataAsset.h"
 #include "Components/StaticMeshComponent.h"
 #include "LBPCGSpawnStructures.generated.h"
 
-struct FPCGCrc;
-
 UCLASS(Abstract, Const, Blueprintable, DefaultToInstanced, EditInlineNew, CollapseCategories, ClassGroup=(Biomes))
 class ULBBiomesInstanceUserData : public UObject
 {
 	GENERATED_BODY()
+
+public:
+	/**
+	 * Delay in seconds before removed instance is restored by regrowth.
+	 * Negative value means the delay of the spawn set is used.
+	 */
+	UFUNCTION(BlueprintNativeEvent, Category=Biomes)
+	float GetRegrowthDelay() const;
+
+	/**
+	 * Actor which replaces the instance when it's promoted by ULBBiomesActorPool.
+	 */
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category=Biomes)
+	TSubclassOf<AActor> ActorClass;
 };
 
 /**
@@ -57,6 +70,13 @@ struct PCGLAYEREDBIOMES_API FLBPCGSpawnInfo
 
 	UPROPERTY(BlueprintReadOnly, EditAnywhere, Category=Biomes, meta=(ClampMin=1, UIMin=1))
 	int Weight = 1;
+
+	/**
+	 * Local bounds of the Mesh, cached by the preset on save and on mesh reimport.
+	 * Allows to apply mesh bounds without loading the mesh itself.
+	 */
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere, AdvancedDisplay, Category=Biomes)
+	FBox MeshBounds = FBox(ForceInit);
 };
 
 USTRUCT(BlueprintType, Category=Biomes)
@@ -69,8 +89,43 @@ struct PCGLAYEREDBIOMES_API FLBPCGSpawnSet
 
 	UPROPERTY(EditAnywhere, Category=Biomes)
 	TArray<FLBPCGSpawnInfo> Actors;
+
+	/**
+	 * Delay before instances removed with regrowth are restored. Zero value disables regrowth.
+	 * Can be overridden by UserData of an actor.
+	 */
+	UPROPERTY(EditAnywhere, Category=Biomes, meta=(ClampMin=0, ForceUnits="s"))
+	float RegrowthDelay = 0.f;
+};
+
+/**
+ * Lookup tables compiled from the preset content. Used on hot paths instead of linear searches.
+ */
+struct PCGLAYEREDBIOMES_API FLBPCGSpawnPresetIndex
+{
+	struct FActorEntry
+	{
+		int32 SetIndex = INDEX_NONE;
+		int32 ActorIndex = INDEX_NONE;
+	};
+
+	int32 FindSetIndex(FName SetName) const;
+	const FActorEntry* FindMesh(const FSoftObjectPath& Mesh) const;
+	ULBBiomesInstanceUserData* GetUserData(int32 SetIndex, int32 ActorIndex) const;
+	
+	TMap<FName, int32> Sets;
+	TMap<FSoftObjectPath, FActorEntry> Meshes;
+	// Index of the first actor of each set in flat tables
+	TArray<int32> SetOffsets;
+	// Flat table of UserData of all actors of all sets
+	TArray<TObjectPtr<ULBBiomesInstanceUserData>> UserData;
+	bool HasUserData = false;
+	// CRC of the preset content, which was used to build the index
+	FPCGCrc Crc;
 };
 
+using FLBPCGSpawnPresetIndexRef = TSharedRef<const FLBPCGSpawnPresetIndex, ESPMode::ThreadSafe>;
+
 UCLASS(ClassGroup=(Biomes))
 class PCGLAYEREDBIOMES_API ULBPCGSpawnPreset : public UPrimaryDataAsset
 {
@@ -80,6 +135,42 @@ public:
 	FPCGCrc ComputeCrc();
 	bool HasUserData() const;
 
+	/**
+	 * Return lookup tables of the preset. Index is built on first access and rebuilt when CRC of the preset is changed.
+	 * Published index is never changed, a rebuilt one replaces it. Hold the reference while using data of the index.
+	 */
+	FLBPCGSpawnPresetIndexRef GetIndex() const;
+	void InvalidateIndex();
+
+	virtual void PostLoad() override;
+	virtual void PreSave(FObjectPreSaveContext SaveContext) override;
+
+#if WITH_EDITOR
+	virtual void PostInitProperties() override;
+	virtual void BeginDestroy() override;
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+
+	/**
+	 * Update cached bounds of all meshes in the preset.
+	 * @return true if any of bounds was changed
+	 */
+	bool RefreshMeshBounds();
+#endif
+
 	UPROPERTY(EditAnywhere, Category=Biomes, meta=(TitleProperty="Name"))
 	TArray<FLBPCGSpawnSet> Sets;
+
+protected:
+	FPCGCrc ComputeContentCrc();
+	FLBPCGSpawnPresetIndexRef BuildIndex() const;
+	
+#if WITH_EDITOR
+	void OnObjectPropertyChanged(UObject* Object, FPropertyChangedEvent& PropertyChangedEvent);
+
+	FDelegateHandle ObjectChangedHandle;
+#endif
+
+	// Only the pointer is guarded by the lock. It's written only when the index is built or invalidated
+	mutable TSharedPtr<const FLBPCGSpawnPresetIndex, ESPMode::ThreadSafe> CompiledIndex;
+	mutable FRWLock IndexLock;
 };
@@ -0,0 +1,171 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LBBiomesPCGUtils.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UObject/Interface.h"
+#include "LBBiomesActorPool.generated.h"
+
+class ULBBiomesInstanceUserData;
+class UInstancedStaticMeshComponent;
+
+UINTERFACE(MinimalAPI, Blueprintable)
+class ULBBiomesPooledActor : public UInterface
+{
+	GENERATED_BODY()
+};
+
+/**
+ * Optional interface of actors spawned by ULBBiomesActorPool. Pooled actors are reused,
+ * so all gameplay state should be reset in OnPromoted.
+ */
+class PCGLAYEREDBIOMES_API ILBBiomesPooledActor
+{
+	GENERATED_BODY()
+
+public:
+	/**
+	 * Actor replaced the instance. Transform is already set.
+	 */
+	UFUNCTION(BlueprintNativeEvent, Category=Biomes)
+	void OnPromoted(const FLBBiomesInstanceHandle& InstanceHandle, ULBBiomesInstanceUserData* UserData);
+
+	/**
+	 * Actor is returned to the pool.
+	 */
+	UFUNCTION(BlueprintNativeEvent, Category=Biomes)
+	void OnDemoted();
+};
+
+USTRUCT()
+struct FLBBiomesPooledActors
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<AActor>> Actors;
+};
+
+USTRUCT()
+struct FLBBiomesPromotedActor
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Transient)
+	FLBBiomesInstanceHandle Handle;
+
+	// Key of the pool the actor is returned to
+	UPROPERTY(Transient)
+	TSubclassOf<ULBBiomesInstanceUserData> UserDataClass;
+};
+
+/**
+ * Replaces mesh instances with actors and back. Actors are recycled per UserData class instead of being destroyed.
+ * Actor class is taken from ActorClass of instance's UserData.
+ * Promoted instances are only hidden, see ULBBiomesInstanceController::HideInstances - they are not saved as removed
+ * until their actors are demoted without restoring.
+ */
+UCLASS()
+class PCGLAYEREDBIOMES_API ULBBiomesActorPool : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	static ULBBiomesActorPool* GetInstance(const UObject* WorldContext);
+	
+	/**
+	 * Hide the instance and place an actor of its UserData in its transform.
+	 * @return Null if instance can't be hidden or its UserData has no actor class.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	AActor* PromoteInstance(UInstancedStaticMeshComponent* Component, int32 InstanceId);
+	
+	/**
+	 * Return the actor to the pool.
+	 * @param Restore Show the instance again, otherwise it's removed for real (e.g. when it's harvested or scheduled for regrowth).
+	 * @return False if the actor was not promoted by the pool.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	bool DemoteActor(AActor* Actor, bool Restore = true);
+
+	/**
+	 * Promote several instances of the component with one ISM update.
+	 * @return Spawned or reused actors. Invalid and duplicated ids are skipped.
+	 */
+	TArray<AActor*> PromoteInstances(UInstancedStaticMeshComponent* Component, TConstArrayView<int32> InstanceIds);
+	
+	/**
+	 * Demote several actors, their instances are shown in batches per component.
+	 * @return Count of actors returned to the pool.
+	 */
+	int32 DemoteActors(TConstArrayView<AActor*> Actors, bool Restore = true);
+
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	AActor* FindPromotedActor(const FLBBiomesInstanceHandle& InstanceHandle) const;
+	AActor* FindPromotedActor(const FLBBiomesPackedInstanceHandle& InstanceHandle) const;
+	
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	FLBBiomesInstanceHandle GetPromotedHandle(const AActor* Actor) const;
+
+	/**
+	 * Spawn actors for UserData in advance, up to MaxPooledActors in runtime settings.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	void Prewarm(const ULBBiomesInstanceUserData* UserData, int32 Count);
+	
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	
+	// Place an actor in the transform of the instance which is already removed
+	AActor* Promote(const FLBBiomesInstanceHandle& Handle, ULBBiomesInstanceUserData* UserData, const FTransform& Transform);
+	
+	AActor* Acquire(const ULBBiomesInstanceUserData* UserData, const FTransform& Transform);
+	void Release(TSubclassOf<ULBBiomesInstanceUserData> UserDataClass, AActor* Actor);
+	AActor* SpawnPooledActor(TSubclassOf<AActor> ActorClass, const FTransform& Transform) const;
+
+	// Return actors whose instances were shown or dropped by the controller
+	void ReleaseShownActors();
+	
+	// Promoted actor was destroyed by gameplay. Its instance is shown again - demote it without restoring to keep it removed
+	UFUNCTION()
+	void OnPromotedActorDestroyed(AActor* Actor);
+
+	static void Activate(AActor* Actor, const FTransform& Transform);
+	static void Deactivate(AActor* Actor);
+
+	UPROPERTY(Transient)
+	TMap<TSubclassOf<ULBBiomesInstanceUserData>, FLBBiomesPooledActors> Pools;
+
+	// Actors are referenced by PromotedActors. Weak, so a destroyed actor is never returned
+	TMap<FLBBiomesPackedInstanceHandle, TWeakObjectPtr<AActor>> Promoted;
+
+	UPROPERTY(Transient)
+	TMap<TObjectPtr<AActor>, FLBBiomesPromotedActor> PromotedActors;
+};
@@ -25,15 +25,25 @@
 
 #include "CoreMinimal.h"
 #include "LBBiomesSpawnManager.h"
+#include "LBBiomesPCGUtils.h"
 #include "InstancedStaticMeshDelegates.h"
 #include "LBPCGSpawnStructures.h"
 #include "UObject/Object.h"
 #include "Engine/StaticMesh.h"
 #include "Subsystems/WorldSubsystem.h"
 #include "Grid/PCGPartitionActor.h"
+#include "Containers/Queue.h"
+#include "Tasks/Task.h"
+#include "Runtime/LBBiomesSpatialGrid.h"
+#include "Runtime/LBBiomesInstanceSnapshot.h"
 #include "LBBiomesInstanceController.generated.h"
 
-struct FLBBiomesInstanceHandle;
+class ULBBiomesPartitionStore;
+class UPCGSettings;
+
+// Removal (with transform, if it's known) or restore recorded by the controller
+DECLARE_MULTICAST_DELEGATE_ThreeParams(FLBBiomesInstanceChanged, const FLBBiomesInstanceHandle& /*Handle*/, bool /*Removed*/, const FTransform* /*RemovedTransform*/);
+DECLARE_MULTICAST_DELEGATE_TwoParams(FLBBiomesPartitionLoadStateChanged, const FLBBiomesPartition& /*Partition*/, bool /*Loaded*/);
 
 USTRUCT(BlueprintType, Category=Biomes)
 struct PCGLAYEREDBIOMES_API FLBBiomesInstanceData
@@ -48,9 +58,13 @@ public:
 	int32 Id = INDEX_NONE;
 	UPROPERTY()
 	FTransform Transform;
+	// Transform might be not saved, it's taken from ISM in this case
+	UPROPERTY()
+	bool HasTransform = true;
 	UPROPERTY()
 	FName ComponentName = NAME_None;
 
+	// Not used anymore - spawn info is resolved per component. Kept to read old saves.
 	UPROPERTY()
 	int32 Custom_SetIndex = INDEX_NONE;
 	UPROPERTY()
@@ -105,11 +119,65 @@ struct PCGLAYEREDBIOMES_API FLBBiomesPersistentMainInstances
 	TArray<FLBBiomesInstanceData> Instances;
 };
 
+/**
+ * Filter of live instances queries. Empty fields match everything.
+ */
+USTRUCT(BlueprintType)
+struct PCGLAYEREDBIOMES_API FLBBiomesInstanceFilter
+{
+	GENERATED_BODY()
+
+	// Name of the spawn set of instances
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category=Biomes)
+	FName SetName = NAME_None;
+	
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category=Biomes)
+	TSubclassOf<ULBBiomesInstanceUserData> UserDataClass;
+};
+
+USTRUCT(BlueprintType)
+struct PCGLAYEREDBIOMES_API FLBBiomesInstanceQueryResult
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category=Biomes)
+	FLBBiomesInstanceHandle Handle;
+	UPROPERTY(BlueprintReadOnly, Category=Biomes)
+	FVector Location = FVector::ZeroVector;
+	UPROPERTY(BlueprintReadOnly, Category=Biomes)
+	int32 SetIndex = INDEX_NONE;
+	UPROPERTY(BlueprintReadOnly, Category=Biomes)
+	int32 ActorIndex = INDEX_NONE;
+	UPROPERTY(BlueprintReadOnly, Category=Biomes)
+	TObjectPtr<ULBBiomesInstanceUserData> UserData;
+};
+
+/**
+ * Scheduled restore of a removed instance.
+ */
+USTRUCT(BlueprintType)
+struct PCGLAYEREDBIOMES_API FLBBiomesRegrowth
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	FLBBiomesInstanceHandle Handle;
+	// Seconds left until the instance is restored
+	UPROPERTY()
+	float Delay = 0.f;
+};
+
+/**
+ * Serialized in compact binary format, see ULBBiomesRuntimeSettings for options.
+ * Data saved with tagged properties by older versions is still readable.
+ */
 USTRUCT(BlueprintType)
 struct PCGLAYEREDBIOMES_API FLBBiomesPersistentInstancesData
 {
 	GENERATED_BODY()
 
+	bool Serialize(FArchive& Ar);
+
 	UPROPERTY()
 	TArray<FGuid> Mains;
 	UPROPERTY()
@@ -119,6 +187,63 @@ struct PCGLAYEREDBIOMES_API FLBBiomesPersistentInstancesData
 	TArray<FLBBiomesPersistentMainInstances> MainInstances;
 	UPROPERTY()
 	TArray<FLBBiomesPersistentPartitionedInstances> PartitionedInstances;
+
+	UPROPERTY()
+	TArray<FLBBiomesRegrowth> Regrowth;
+};
+
+template<>
+struct TStructOpsTypeTraits<FLBBiomesPersistentInstancesData> : public TStructOpsTypeTraitsBase2<FLBBiomesPersistentInstancesData>
+{
+	enum
+	{
+		WithSerializer = true,
+	};
+};
+
+/**
+ * Single removal or restore of an instance.
+ */
+USTRUCT(BlueprintType)
+struct PCGLAYEREDBIOMES_API FLBBiomesJournalEntry
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	int64 Sequence = 0;
+	UPROPERTY()
+	FLBBiomesInstanceHandle Handle;
+	// Instance was removed, otherwise it was restored
+	UPROPERTY()
+	bool Removed = true;
+	// Transform of removed instance
+	UPROPERTY()
+	FTransform Transform;
+	// Transform is not known, instance can't be restored from the entry
+	UPROPERTY()
+	bool HasTransform = true;
+};
+
+/**
+ * Part of the journal, which can be applied over the state it was made after.
+ * Group ids of handles refer to Mains and Partitions of the journal.
+ */
+USTRUCT(BlueprintType)
+struct PCGLAYEREDBIOMES_API FLBBiomesPersistentJournal
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<FGuid> Mains;
+	UPROPERTY()
+	TArray<FLBBiomesPartition> Partitions;
+	
+	UPROPERTY()
+	TArray<FLBBiomesJournalEntry> Entries;
+
+	// Whole regrowth schedule at the moment the journal was taken
+	UPROPERTY()
+	TArray<FLBBiomesRegrowth> Regrowth;
 };
 
 USTRUCT()
@@ -126,103 +251,612 @@ struct FLBBiomesISMList
 {
 	GENERATED_BODY()
 
+	/**
+	 * Return component by name if it is still alive and belongs to the Owner.
+	 */
+	UInstancedStaticMeshComponent* Find(const FName& ComponentName, const AActor* Owner) const;
+	
 	UPROPERTY(Transient)
-	TArray<TObjectPtr<UInstancedStaticMeshComponent>> Components;
+	TMap<FName, TObjectPtr<UInstancedStaticMeshComponent>> Components;
+
+	// Frame when the list was built. Missing components don't trigger more than one rebuild per frame
+	uint64 BuildFrame = 0;
 };
 
 /**
  * 
  */
 UCLASS()
-class PCGLAYEREDBIOMES_API ULBBiomesInstanceController : public UWorldSubsystem
+class PCGLAYEREDBIOMES_API ULBBiomesInstanceController : public UTickableWorldSubsystem
 {
 	GENERATED_BODY()
 
 public:
 	ULBBiomesInstanceController();
 
+	/**
+	 * Mapping between current (local) indices of ISM instances and their original indices, which are used in handles.
+	 * Only moved instances are stored, all others are mapped to themselves.
+	 * Order preserving removal shifts every following instance, so maps are replaced by dense arrays once
+	 * they would cover a large part of the component.
+	 */
+	struct FIndexMapping
+	{
+		int32 ToOriginal(int32 LocalId) const;
+		int32 ToLocal(int32 OriginalId) const;
+
+		// Instance with OriginalId is placed at LocalId now. Keeps the mapping one-to-one 
+		void Set(int32 LocalId, int32 OriginalId);
+		// Instances at these local indices were swapped
+		void Swap(int32 LocalA, int32 LocalB);
+		// Relocated items of an ISM update are swapped in order. Each touched index is written once
+		void Relocate(TConstArrayView<FInstancedStaticMeshDelegates::FInstanceIndexUpdateData> Data);
+		
+	private:
+		void Link(int32 LocalId, int32 OriginalId);
+		// Dense arrays take less memory when at least 1/DenseFactor of indices is moved
+		bool ShouldBeDense(int32 NumLinks, int32 MaxId) const { return NumLinks * DenseFactor > MaxId + 1; }
+		void MakeDense();
+		// Indices beyond the arrays are mapped to themselves
+		void GrowDense(int32 Num);
+		
+		static constexpr int32 DenseFactor = 4;
+		
+		TMap<int32, int32> LocalToOriginal;
+		TMap<int32, int32> OriginalToLocal;
+		// Largest index in the maps
+		int32 MaxIndex = 0;
+		
+		// Replace the maps when not empty. Never switched back, their size is bounded by the component
+		TArray<int32> DenseLocalToOriginal;
+		TArray<int32> DenseOriginalToLocal;
+	};
+	
 	using FBiomesInstances = TArray<FLBBiomesInstanceData>;
-	using FTrackedComponents = TMap<TWeakObjectPtr<const UInstancedStaticMeshComponent>, TArray<int32>>;
+	using FTrackedComponents = TMap<TWeakObjectPtr<const UInstancedStaticMeshComponent>, FIndexMapping>;
 	
 	static ULBBiomesInstanceController* GetInstance(const UObject* WorldContext);
 	
 	FLBBiomesInstanceHandle RemoveInstance(UInstancedStaticMeshComponent* Component, int32 InstanceId);
+	
+	/**
+	 * Remove several instances of the component with one ISM update.
+	 * @return Handles of removed instances. Invalid and duplicated ids are skipped.
+	 */
+	TArray<FLBBiomesInstanceHandle> RemoveInstances(UInstancedStaticMeshComponent* Component, TConstArrayView<int32> InstanceIds);
+	
+	/**
+	 * Remove all biome instances overlapping the area. Instances are removed by one batch per ISM component.
+	 */
+	TArray<FLBBiomesInstanceHandle> RemoveInstancesInBox(const FBox& Box);
+	TArray<FLBBiomesInstanceHandle> RemoveInstancesInSphere(const FVector& Center, float Radius);
+	
+	/**
+	 * Instance of a loaded actor can be restored only if its transform is known, otherwise it stays removed.
+	 * Instances of unloaded actors are always restored - they are spawned with their actor.
+	 * @return False if the instance is not removed or can't be restored.
+	 */
 	bool RestoreInstance(const FLBBiomesInstanceHandle& InstanceHandle);
+	void RestoreInstances(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles);
+
+	/**
+	 * Remove instances from the ISM without changing the state of removed instances, e.g. while they are replaced by actors.
+	 * Hidden instances are not saved, journaled, replicated or published in snapshots.
+	 * They are shown again by ShowInstances, by SetPersistentData and by changes of their group made by ApplyJournal,
+	 * or dropped when their actor is unloaded or regenerated - see OnHiddenInstancesReleased.
+	 * @return Handles of hidden instances. Invalid and duplicated ids are skipped.
+	 */
+	TArray<FLBBiomesInstanceHandle> HideInstances(UInstancedStaticMeshComponent* Component, TConstArrayView<int32> InstanceIds);
+	void ShowInstances(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles);
+	
+	/**
+	 * Turn hidden instances into removed ones, as if they were removed by RemoveInstances.
+	 */
+	void RemoveHiddenInstances(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles);
+	
+	bool IsHidden(const FLBBiomesInstanceHandle& InstanceHandle) const;
+
+	/**
+	 * Remove the instance and restore it after the regrowth delay of its UserData or spawn set.
+	 * Instances without the delay are removed permanently.
+	 */
+	FLBBiomesInstanceHandle RemoveInstanceWithRegrowth(UInstancedStaticMeshComponent* Component, int32 InstanceId);
+	
+	/**
+	 * Restore removed instance after the delay in seconds of game time. Replaces previous schedule of the instance.
+	 * Due instances are restored in batches per component, see ULBBiomesRuntimeSettings for the budget.
+	 */
+	void ScheduleRegrowth(const FLBBiomesInstanceHandle& InstanceHandle, float Delay);
+	void CancelRegrowth(const FLBBiomesInstanceHandle& InstanceHandle);
+	
+	// Delay of UserData or spawn set of instances of the component, zero if they don't regrow
+	float GetRegrowthDelay(const UInstancedStaticMeshComponent* Component) const;
+
+	/**
+	 * Return handles of removed instances located in the area, whether their actors are loaded or not.
+	 * Only instances with known transforms are indexed, and only of components which have been loaded during the session,
+	 * since locations of components are not saved. With partition store - only of partitions kept in memory.
+	 */
+	TArray<FLBBiomesInstanceHandle> FindRemovedInstancesInBox(const FBox& Box) const;
+	TArray<FLBBiomesInstanceHandle> FindRemovedInstancesInSphere(const FVector& Center, float Radius) const;
+
+	/**
+	 * Return live instances of loaded partitions in the sphere. Requires IndexLiveInstances in runtime settings.
+	 */
+	TArray<FLBBiomesInstanceQueryResult> FindInstancesInSphere(const FVector& Center, float Radius, const FLBBiomesInstanceFilter& Filter);
+	
+	/**
+	 * Return up to Count live instances of loaded partitions nearest to the Location, sorted by distance.
+	 * Requires IndexLiveInstances in runtime settings.
+	 */
+	TArray<FLBBiomesInstanceQueryResult> FindNearestInstances(const FVector& Location, int32 Count, float MaxDistance,
+		const FLBBiomesInstanceFilter& Filter);
+
+	/**
+	 * Return component and current index of the live instance.
+	 */
+	UInstancedStaticMeshComponent* ResolveInstance(const FLBBiomesInstanceHandle& InstanceHandle, int32& OutInstanceId);
+
+	/**
+	 * Deferred versions of RemoveInstance and RestoreInstance. Versions which take a handle can be called from any thread.
+	 * Requests are applied on the game thread once per frame in the order they were made,
+	 * consecutive requests of the same kind are coalesced into one batch per component.
+	 */
+	void EnqueueRemoveInstance(const FLBBiomesInstanceHandle& InstanceHandle);
+	void EnqueueRestoreInstance(const FLBBiomesInstanceHandle& InstanceHandle);
+	
+	/**
+	 * Make a handle of the instance and queue its removal. Game thread only.
+	 * @return Handle of the instance which will be removed.
+	 */
+	FLBBiomesInstanceHandle EnqueueRemoveInstance(UInstancedStaticMeshComponent* Component, int32 InstanceId);
+	
+	/**
+	 * Apply all queued requests now. Called automatically every frame and before any immediate change.
+	 */
+	void FlushPendingRequests();
 
 	bool GetInstanceTransform(const FLBBiomesInstanceHandle& InstanceHandle, FTransform& InstanceTransform);
 	ULBBiomesInstanceUserData* GetUserData(const FLBBiomesInstanceHandle& InstanceHandle);
 
+	/**
+	 * Return the latest snapshot of removed instances. Can be called from any thread.
+	 * Only copying the pointer takes a short lock, content of the snapshot is read without locks.
+	 * Changes are published once per frame. With partition store, only partitions kept in memory are included.
+	 */
+	FLBBiomesInstanceSnapshotPtr GetSnapshot() const;
+	
+	/**
+	 * Publish changes made so far without waiting for the end of the frame.
+	 */
+	void PublishSnapshot();
+
 	/**
 	 * Return structure which contains all information about removed instances in the world.
-	 * Can be stored anywhere and restored later with SetPersistentData
+	 * Can be stored anywhere and restored later with SetPersistentData.
+	 * If partition store is set, removed instances of partitions are kept in it and only the table of partitions is returned.
+	 * SavePartitions should be called together with it, so the store matches the returned data.
 	 */
 	UFUNCTION(BlueprintCallable, Category=Biomes)
 	FLBBiomesPersistentInstancesData GetPersistentData() const;
 	
 	/**
 	 * Restore information about all removed instances in the world. 
+	 * If partition store is set, partitions which are not present in Data keep their state from the store.
 	 * @param Data Which was returned by GetPersistentData.
 	 */
 	UFUNCTION(BlueprintCallable, Category=Biomes)
 	void SetPersistentData(const FLBBiomesPersistentInstancesData& Data);
 
+	/**
+	 * Sequence number of the last removal or restore recorded in the journal.
+	 * Autosave can store only entries made after the previous save, see GetJournalTail.
+	 * Entries are kept in memory until CompactJournal, or until there are more of them than MaxJournalEntries.
+	 * Journal is recorded only if JournalChanges is enabled in runtime settings.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	int64 GetJournalSequence() const { return JournalSequence; }
+
+	/**
+	 * Return journal entries recorded after SinceSequence.
+	 * @return False if some of them are already compacted or journal is disabled - the snapshot should be saved instead.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	bool GetJournalTail(int64 SinceSequence, FLBBiomesPersistentJournal& OutJournal) const;
+
+	/**
+	 * Replay removals and restores over the current state.
+	 * Usually called right after SetPersistentData with the snapshot the journal was made after.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	void ApplyJournal(const FLBBiomesPersistentJournal& Journal);
+
+	/**
+	 * Same as ApplyJournal, but keeps the regrowth schedule. Used to apply changes made by the server.
+	 */
+	void ApplyJournalEntries(const FLBBiomesPersistentJournal& Journal);
+
+	/**
+	 * Merge journal entries up to the sequence into the snapshot on a worker thread and drop them from the journal.
+	 * The snapshot starts from the data passed to SetPersistentData.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	void CompactJournal(int64 UpToSequence);
+
+	/**
+	 * Return the compacted state. Waits for running compaction.
+	 * @return Sequence of the last journal entry merged into the snapshot, or -1 if journal is disabled.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	int64 GetJournalSnapshot(FLBBiomesPersistentInstancesData& OutData);
+
+	/**
+	 * Keep removed instances of partitions in the store as separate chunks instead of memory.
+	 * Chunk is read asynchronously when its partition is loaded. Changed partitions stay in memory until SavePartitions,
+	 * so the store contains only saved progress. Each save slot should have its own store.
+	 * State of partitions which are not loaded is taken from the new store, null store keeps everything in memory.
+	 * Unsaved changes of unloaded partitions are discarded. Should be set before SetPersistentData.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	void SetPartitionStore(ULBBiomesPartitionStore* Store);
+
+	/**
+	 * Write changed state of partitions to the partition store on a worker thread.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	void SavePartitions();
+
 	void OnPartitionLoaded(APCGPartitionActor* PartitionActor);
 	void OnPartitionUnloaded(APCGPartitionActor* PartitionActor);
 
+	/**
+	 * Groups are identified by Main guid for non-partitioned PCG components and by Partition otherwise.
+	 * Unlike group ids, these keys are the same on all machines.
+	 */
+	bool GetGroupKey(int32 GroupId, FGuid& OutMain, FLBBiomesPartition& OutPartition) const;
+	int32 GetGroupIdByKey(const FGuid& Main, const FLBBiomesPartition& Partition);
+	
+	// Group ids of non-partitioned PCG components are -1..-Num
+	int32 GetNumMainGroups() const;
+	
+	void GetRemovedInstances(int32 GroupId, FBiomesInstances& OutInstances);
+
+	// Every removal and restore, including ones made by ApplyJournal
+	FLBBiomesInstanceChanged OnInstanceChanged;
+	// Hidden instances were shown or dropped by the controller itself. Handles which are not hidden anymore should be forgotten
+	FSimpleMulticastDelegate OnHiddenInstancesReleased;
+	// Whole state was replaced by SetPersistentData
+	FSimpleMulticastDelegate OnStateReset;
+	FLBBiomesPartitionLoadStateChanged OnPartitionLoadStateChanged;
+
 	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
 	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
 
+	/**
+	 * Collect instances removed from components of PCG component which is being generated, grouped by mesh.
+	 * These instances are considered not spawned - original indices of other instances are restored after generation.
+	 * Only meshes whose instances all passed through this node in the previous complete generation of the group
+	 * are returned, so ordinals of points match original indices. Nothing is prefiltered before that.
+	 * @param Node Settings of the filter node which drops the points.
+	 */
+	void PrefilterGeneration(const UPCGComponent* PcgComponent, const UPCGSettings* Node, TMap<FSoftObjectPath, TBitArray<>>& OutRemoved);
+	
+	/**
+	 * Number of points of each mesh output by the filter node during the generation.
+	 */
+	void ReportFilteredMeshes(const UPCGComponent* PcgComponent, const UPCGSettings* Node, const TMap<FSoftObjectPath, int32>& NumPoints);
+	
 	void RegisterManager(ULBBiomesSpawnManager* Manager);
 	void UnRegisterManager(ULBBiomesSpawnManager* Manager);
 
+	/**
+	 * Drop cached ISM components of the actor. Should be called when components are added to or removed from it
+	 * outside of PCG generation. Stale or missing components are detected on lookup anyway.
+	 */
+	void InvalidateISMList(AActor* Actor);
+
 protected:
+	/**
+	 * Removed instances of a single ISM component. Bits are indexed by original indices of instances.
+	 */
+	struct FRemovedInstances
+	{
+		bool Contains(int32 Id) const { return Removed.IsValidIndex(Id) && Removed[Id]; }
+		void Add(int32 Id, const FTransform* Transform);
+		void Remove(int32 Id);
+		int32 Num() const { return Count; }
+		const FTransform* FindTransform(int32 Id) const { return Transforms.Find(Id); }
+
+		TBitArray<> Removed;
+		// Transforms can't be read from ISM after removal. They are kept while the actor is loaded and dropped
+		// when it's unloaded, unless they are persisted (see PersistentTransforms)
+		TMap<int32, FTransform> Transforms;
+		int32 Count = 0;
+		// Mesh of the component, known after the component was changed by controller
+		FSoftObjectPath Mesh;
+		// Removed instances were not spawned by the current generation of the component
+		bool Prefiltered = false;
+	};
+
+	/**
+	 * Removed instances of a non-partitioned PCG component or of a partition.
+	 */
+	struct FInstanceGroup
+	{
+		bool Contains(const FName& ComponentName, int32 Id) const;
+		void Add(const FName& ComponentName, int32 Id, const FTransform* Transform);
+		bool Remove(const FName& ComponentName, int32 Id);
+		bool IsEmpty() const { return Components.IsEmpty(); }
+		int32 Num() const;
+		
+		void Reset(const FBiomesInstances& InInstances);
+		void ToInstances(FBiomesInstances& OutInstances) const;
+
+		TMap<FName, FRemovedInstances> Components;
+		// Group of a partition is kept in the partition store until it's needed
+		bool Resident = true;
+		// Changed since it was read from the partition store
+		bool Dirty = false;
+	};
+	
+	struct FLiveInstanceKey
+	{
+		FName ComponentName;
+		int32 InstanceId = INDEX_NONE;
+
+		bool operator==(const FLiveInstanceKey& Other) const
+		{
+			return InstanceId == Other.InstanceId && ComponentName == Other.ComponentName;
+		}
+
+		friend uint32 GetTypeHash(const FLiveInstanceKey& Key)
+		{
+			return HashCombine(GetTypeHash(Key.ComponentName), GetTypeHash(Key.InstanceId));
+		}
+	};
+
+	// All instances of ISM share the same spawn info
+	struct FLiveComponent
+	{
+		int32 SetIndex = INDEX_NONE;
+		int32 ActorIndex = INDEX_NONE;
+		FName SetName;
+		TWeakObjectPtr<ULBBiomesInstanceUserData> UserData;
+	};
+
+	/**
+	 * Live instances of a loaded partition, keyed by original indices.
+	 */
+	struct FLiveIndex
+	{
+		int32 GroupId = 0;
+		FBox Bounds = FBox(ForceInit);
+		TMap<FName, FLiveComponent> Components;
+		TLBBiomesSpatialGrid<FLiveInstanceKey> Grid;
+		// Built from the current state of ISMs
+		bool Valid = false;
+	};
+	
+	struct FRegrowth
+	{
+		double Time = 0.0;
+		FLBBiomesPackedInstanceHandle Handle;
+
+		bool operator<(const FRegrowth& Other) const { return Time < Other.Time; }
+	};
+	
+	struct FJournalSnapshot
+	{
+		FLBBiomesPersistentInstancesData Data;
+		int64 Sequence = 0;
+	};
+	
 	struct FResult
 	{
-		FBiomesInstances* Instances = nullptr;
-		int32 Index = INDEX_NONE;
+		FInstanceGroup* Group = nullptr;
+		FRemovedInstances* Instances = nullptr;
 		AActor* Actor = nullptr;
 
-		const FLBBiomesInstanceData& GetData() const { return (*Instances)[Index]; }
+		const FTransform* GetTransform(int32 Id) const { return Instances->FindTransform(Id); }
+	};
+	
+	enum class EPendingRequest : uint8
+	{
+		Remove,
+		Restore
+	};
+	
+	struct FPendingRequest
+	{
+		EPendingRequest Type = EPendingRequest::Remove;
+		// Original index, so the request stays valid while components change
+		FLBBiomesInstanceHandle Handle;
+	};
+	
+	/**
+	 * Saved state of a loaded partition, which is applied over several frames.
+	 */
+	struct FLoadingPartition
+	{
+		struct FComponentWork
+		{
+			FName ComponentName;
+			// Snapshot of the state, consumed by the task
+			TBitArray<> Removed;
+			FIndexMapping Mapping;
+			// Local and original indices, sorted by local indices in reverse order. Prepared by the task
+			TArray<TPair<int32, int32>> Instances;
+			int32 NumRemoved = 0;
+		};
+		
+		TWeakObjectPtr<AActor> Actor;
+		FVector Location = FVector::ZeroVector;
+		int32 GroupId = 0;
+		TArray<FComponentWork> Components;
+		int32 NextComponent = 0;
+		int32 NumRemoved = 0;
+		bool Success = true;
+		UE::Tasks::FTask Task;
 	};
 	
 	bool FindDataByHandle(const FLBBiomesInstanceHandle& Handle, FResult& Result);
 
+	// Thread safe, return 0 if PCG component can't be tracked
+	int32 GetGroupId(const UPCGComponent* PcgComponent);
+	FLBBiomesInstanceHandle MakeHandle(const UInstancedStaticMeshComponent* Component, int32 InstanceId);
 	FLBBiomesInstanceHandle RemoveInstanceImpl(UInstancedStaticMeshComponent* Component, int32 InstanceId);
-	bool RestoreInstanceImpl(const FName& ComponentName, const FLBBiomesInstanceData& Data, AActor* Actor);
-
-	static void EnsureInstancesUnique(const FTransform& Transform, const int32 OriginalIndex, const FName ComponentName, const TArray<FLBBiomesInstanceData>& Instances);
+	TArray<FLBBiomesInstanceHandle> RemoveInstancesInArea(const FBox& Bounds,
+		TFunctionRef<TArray<int32>(const UInstancedStaticMeshComponent*)> Query);
+	bool RestoreInstanceImpl(const FName& ComponentName, int32 Id, const FTransform& Transform, AActor* Actor);
+	
+	struct FAddedInstances
+	{
+		TArray<int32> OriginalIds;
+		TArray<FTransform> Transforms;
+	};
+	void AddInstances(const TMap<UInstancedStaticMeshComponent*, FAddedInstances>& Components);
+	
+	// Record the instance as removed, it should be removed from the ISM by the caller
+	void RecordRemoval(UInstancedStaticMeshComponent* Component, const FLBBiomesInstanceHandle& Handle, const FTransform& Transform);
+	
+	void ShowHiddenGroup(int32 GroupId);
+	void DropHiddenGroup(int32 GroupId);
+	UInstancedStaticMeshComponent* ResolveInstanceImpl(const FLBBiomesInstanceHandle& InstanceHandle, int32& OutInstanceId);
+	void ApplyPendingRemovals(TConstArrayView<FLBBiomesInstanceHandle> InstanceHandles);
 
 	UPCGComponent* FindPcgComponent(const FGuid& Guid);
 	
-	const TArray<TObjectPtr<UInstancedStaticMeshComponent>>& CachePartition(AActor* Actor);
+	FLBBiomesISMList& CachePartition(AActor* Actor);
+	FLBBiomesISMList& RebuildISMList(AActor* Actor);
 	UInstancedStaticMeshComponent* FindISM(AActor* Actor, const FName& ComponentName);
-	static UInstancedStaticMeshComponent* FindISM(const FName& ComponentName, const TArray<TObjectPtr<UInstancedStaticMeshComponent>>* ISMs);
 	
-	FBiomesInstances* GetInstancesFor(const APCGPartitionActor* PartitionActor);
-
-	int16 GetMainIndex(const UPCGComponent* Component);
-	int16 GetPartitionIndex(const FIntVector& ActorGridCoords, uint32 ActorGridSize);
 
-	int32 GetOriginalIndex(UInstancedStaticMeshComponent* Component, int32 InstanceId);
+	// Thread safe, return existing index or add a new one
+	int32 GetMainIndex(const UPCGComponent* Component);
+	int32 GetMainIndex(const FGuid& Guid);
+	int32 GetPartitionIndex(const FIntVector& ActorGridCoords, uint32 ActorGridSize);
+
+	// Thread safe
+	int32 FindMainIndex(const FGuid& Guid) const;
+	int32 FindPartitionIndex(const FLBBiomesPartition& Partition) const;
+	FGuid GetMainGuid(int32 Index) const;
+	FLBBiomesPartition GetPartition(int32 Index) const;
+
+	// GroupsLock should be locked for writing
+	int32 AddMain(const FGuid& Guid);
+	int32 AddPartition(const FLBBiomesPartition& Partition);
+
+	// Game thread only. Creates the group if it doesn't exist yet and reads it from the partition store
+	FInstanceGroup& GetGroup(int32 GroupId);
+	// Same, but the group of a partition isn't read from the store, it might be not resident
+	FInstanceGroup& GetGroupSlot(int32 GroupId);
+
+	void PageInPartition(int32 Index);
+	void PageOutPartition(int32 Index);
+	void PageOutUnloadedPartitions();
+	// Start reading the chunk on a worker thread, it's picked up by PageInPartition
+	void RequestChunk(const FLBBiomesPartition& Partition);
+	// Wait for running reads and writes of the store
+	void WaitForChunks();
+	// Thread safe. Return false if there is no valid chunk of the partition
+	static bool ReadChunk(const ULBBiomesPartitionStore* Store, const FLBBiomesPartition& Partition, FInstanceGroup& OutGroup);
+	static void WriteChunk(const FLBBiomesPartition& Partition, const FInstanceGroup& Group, TArray<uint8>& OutBytes);
+	
+	// Apply the state of the partition, once its group is resident
+	void StartLoadingPartition(APCGPartitionActor* PartitionActor);
+	// Start loading partitions which chunks have been read
+	void ProcessReadingPartitions();
+	
+	// Thread safe
+	int32 GetOriginalIndex(const UInstancedStaticMeshComponent* Component, int32 InstanceId) const;
 	void SetOriginalIndex(const UInstancedStaticMeshComponent* Component, int32 OriginalId, int32 InstanceId);
-	void Track(UInstancedStaticMeshComponent* Component);
-	static void InitTrackedComponent(const UInstancedStaticMeshComponent* Component, TArray<signed int>& Mapping);
+	FIndexMapping& Track(const UInstancedStaticMeshComponent* Component);
+	void UnTrack(AActor* Actor);
+	
+	void BuildLiveIndex(AActor* Actor, FLiveIndex& Index);
+	// Instance was removed if Transform is null
+	void UpdateLiveIndex(UInstancedStaticMeshComponent* Component, int32 OriginalId, const FTransform* Transform);
+	void InvalidateLiveIndex(AActor* Actor);
+	// Build invalid indices overlapping the bounds
+	void ForEachLiveIndex(const FBox& Bounds, TFunctionRef<void(FLiveIndex&)> Callback);
+	static bool MatchesFilter(const FLiveComponent& Component, const FLBBiomesInstanceFilter& Filter);
+	static FLBBiomesInstanceQueryResult MakeQueryResult(const FLiveIndex& Index, const FLiveInstanceKey& Key, const FLiveComponent& Component,
+		const FVector& Location);
+	
+	// Owner of the PCG component of the group if it's loaded
+	AActor* GetGroupActor(int32 GroupId);
+	// Add or remove all removed instances of the group to the spatial index.
+	// Instances are added only if location of their component is known
+	void IndexGroup(int32 GroupId, const FInstanceGroup& Group, bool Add);
+	// Remember location of the component if it's loaded, otherwise return the one seen before
+	const FTransform* FindComponentTransform(int32 GroupId, const FName& ComponentName, const UInstancedStaticMeshComponent* Component);
+	void RebuildRemovedIndex();
 	
-	bool ApplyStateToActor(AActor* Actor, const FBiomesInstances& Instances, bool ConvertToLocal);
+	double GetRegrowthTime() const;
+	void ProcessRegrowth();
+	void GetRegrowth(TArray<FLBBiomesRegrowth>& OutRegrowth) const;
+	
+	// Null transform means the instance was restored
+	void AppendJournal(const FLBBiomesInstanceHandle& Handle, bool Removed, const FTransform* RemovedTransform);
+	void CompactFullJournal();
+	void ResetJournal(const FLBBiomesPersistentInstancesData& Data);
+	
+	// Changed components are copied, other ones are shared with the previous group. Null set means all components
+	FLBBiomesInstanceSnapshot::FGroupPtr MakeSnapshotGroup(int32 GroupId, const FInstanceGroup& Group,
+		const FLBBiomesInstanceSnapshot::FGroup* Previous, const TSet<FName>* ChangedComponents);
+	int32 MapJournalGroupId(const FLBBiomesPersistentJournal& InJournal, int32 GroupId);
+	void WaitForCompaction();
+	static TSharedPtr<FJournalSnapshot> MergeJournal(const FJournalSnapshot& Base, TConstArrayView<FLBBiomesJournalEntry> Entries,
+		const TArray<FGuid>& InMains, const TArray<FLBBiomesPartition>& InPartitions);
+	
+	bool ApplyStateToActor(AActor* Actor, FInstanceGroup& Group);
+	// Restore instances removed only in Current and remove instances removed only in Incoming
+	bool ApplyGroupDiff(AActor* Actor, const FInstanceGroup& Current, FInstanceGroup& Incoming);
+	bool ApplyComponentDiff(UInstancedStaticMeshComponent* Component, const FRemovedInstances* Current, FRemovedInstances* Incoming);
+	
+	static void PrepareLoadingPartition(FLoadingPartition& Partition);
+	// Return false if the budget was exceeded before all instances were removed
+	bool ContinueLoadingPartition(FLoadingPartition& Partition, double EndTime, int32 BatchSize);
+	void FinishLoadingPartition(const FLoadingPartition& Partition);
+	void ProcessLoadingPartitions();
+	// Apply the rest of the partition state immediately. Should be called before any other change of the actor
+	void CompleteLoadingPartition(const AActor* Actor);
+	void CancelLoadingPartition(const AActor* Actor);
+	
+	void OnGenerationDone(UPCGSubsystem* Subsystem);
+	// Return false if removed instances can't be a part of the generated component
+	bool InstallPrefilteredMapping(UInstancedStaticMeshComponent* Component, const FRemovedInstances& Instances);
 	
 	void OnInstanceIndexRelocated(UInstancedStaticMeshComponent* Component, TArrayView<const FInstancedStaticMeshDelegates::FInstanceIndexUpdateData> Data);
 	static void OnInstanceIndexUpdated(UInstancedStaticMeshComponent* Component, TArrayView<const FInstancedStaticMeshDelegates::FInstanceIndexUpdateData> Data);
 
 protected:
-	TMap<FGuid, FBiomesInstances> MainInstances;
-	TMap<FLBBiomesPartition, FBiomesInstances> PartitionedInstances;
-
+	// Guards Mains, Partitions and their reverse mappings, which can be extended by requests from other threads
+	mutable FRWLock GroupsLock;
+	
 	// Persistent array of non-partitioned PCG components.
 	// Indices of it are used in handles, so they should never be changed
 	TArray<FGuid> Mains;
 	// Persistent array of partitions. Indices of it are used in handles, so they should never be changed
 	TArray<FLBBiomesPartition> Partitions;
 
+	// Removed instances, indexed the same way as Mains and Partitions. Game thread only, might be shorter than them
+	TArray<FInstanceGroup> MainGroups;
+	TArray<FInstanceGroup> PartitionGroups;
+
+	// Reverse mapping of Mains and Partitions
+	TMap<FGuid, int32> MainIndices;
+	TMap<FLBBiomesPartition, int32> PartitionIndices;
+
+	UPROPERTY(Transient)
+	TObjectPtr<ULBBiomesPartitionStore> PartitionStore;
+
+	// Referenced by snapshots, which can't keep them alive themselves
+	UPROPERTY(Transient)
+	TSet<TObjectPtr<ULBBiomesInstanceUserData>> SnapshotUserData;
+
 	UPROPERTY(Transient)
 	TMap<TObjectPtr<AActor>, FLBBiomesISMList> ISMMapping;
 	UPROPERTY(Transient)
@@ -230,7 +864,70 @@ protected:
 	UPROPERTY(Transient)
 	TArray<TWeakObjectPtr<ULBBiomesSpawnManager>> Managers;
 	
+	// Written on the game thread only, so the game thread reads it without locking
+	mutable FRWLock MappingLock;
 	FTrackedComponents TrackedComponents;
+
+	// Removals and restores which are not merged into JournalSnapshot yet
+	TArray<FLBBiomesJournalEntry> Journal;
+	int64 JournalSequence = 0;
+	// Entries up to this sequence are merged or being merged into the snapshot
+	int64 CompactedSequence = 0;
+	TSharedPtr<FJournalSnapshot> JournalSnapshot = MakeShared<FJournalSnapshot>();
+	UE::Tasks::TTask<TSharedPtr<FJournalSnapshot>> CompactionTask;
+	// JournalChanges setting, it's read again by SetPersistentData
+	bool Journaling = false;
+
+	// Only the pointer is guarded, published snapshots are never changed
+	mutable FRWLock SnapshotLock;
+	FLBBiomesInstanceSnapshotPtr Snapshot = MakeShared<FLBBiomesInstanceSnapshot, ESPMode::ThreadSafe>();
+	// Groups loaded since the last publication
+	TSet<int32> DirtySnapshotGroups;
+	// Components changed since the last publication
+	TMap<int32, TSet<FName>> DirtySnapshotComponents;
+	bool SnapshotReset = false;
+
+	// Locations of removed instances
+	TLBBiomesSpatialGrid<FLBBiomesPackedInstanceHandle> RemovedIndex;
+	// World transforms of components seen during the session. Keys don't depend on group ids, which are changed by SetPersistentData
+	using FComponentKey = TTuple<FGuid, FLBBiomesPartition, FName>;
+	TMap<FComponentKey, FTransform> ComponentTransforms;
+	// Locations of live instances of loaded partitions
+	TMap<TWeakObjectPtr<AActor>, FLiveIndex> LiveIndices;
+	
+	// Min-heap by restore time. Entries which don't match RegrowthTimes were rescheduled or canceled
+	TArray<FRegrowth> RegrowthQueue;
+	TMap<FLBBiomesPackedInstanceHandle, double> RegrowthTimes;
+	
+	// Instances removed from ISM by HideInstances. They are not part of the state, only transforms to show them are kept
+	TMap<int32, FInstanceGroup> HiddenGroups;
+
+	TQueue<FPendingRequest, EQueueMode::Mpsc> PendingRequests;
+	// Immediate changes made while requests are applied don't flush requests queued in the meantime
+	bool FlushingRequests = false;
+	TArray<TSharedPtr<FLoadingPartition>> LoadingPartitions;
+	
+	// Changed groups of unloaded partitions which are not saved to the partition store yet. Empty group removes the chunk
+	TMap<FLBBiomesPartition, FInstanceGroup> StagedChunks;
+	TMap<FLBBiomesPartition, UE::Tasks::TTask<FInstanceGroup>> ChunkReads;
+	// Reads start after writes of the previous SavePartitions
+	UE::Tasks::FTask ChunkWrites;
+	// Loaded partitions which wait for their chunks
+	TArray<TWeakObjectPtr<APCGPartitionActor>> ReadingPartitions;
+	/**
+	 * Meshes seen by filter nodes during a generation. Mesh is shared if more than one node execution has seen it.
+	 */
+	struct FFilteredGeneration
+	{
+		TMap<FSoftObjectPath, FObjectKey> Nodes;
+		TMap<FSoftObjectPath, int32> NumPoints;
+		TSet<FSoftObjectPath> Shared;
+	};
+	// Actors which generate content with filter nodes. Original indices are restored when generation is done
+	TMap<TWeakObjectPtr<AActor>, FFilteredGeneration> FilteringActors;
+	// Meshes which can be prefiltered in the next generation of the group, with the only node which spawns them
+	TMap<int32, TMap<FSoftObjectPath, FObjectKey>> UniqueMeshes;
+	FDelegateHandle GenerationDoneHandle;
 	FDelegateHandle DelegateHandle;
 };
 
@@ -0,0 +1,80 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LBBiomesPCGUtils.h"
+
+class ULBBiomesInstanceUserData;
+
+/**
+ * Immutable state of removed instances published by ULBBiomesInstanceController after each batch of changes.
+ * Content is never changed after publication, so it can be read from any thread without locks.
+ * Components which didn't change are shared between versions, only changed ones are copied.
+ * UserData is kept alive by the controller, it's known only for components which were loaded since they changed.
+ */
+class PCGLAYEREDBIOMES_API FLBBiomesInstanceSnapshot
+{
+public:
+	struct FComponent
+	{
+		// Indexed by original instance id
+		TBitArray<> Removed;
+		// Relative to the component, only of instances with known transforms
+		TMap<int32, FTransform> Transforms;
+		const ULBBiomesInstanceUserData* UserData = nullptr;
+	};
+	
+	using FComponentPtr = TSharedPtr<const FComponent, ESPMode::ThreadSafe>;
+	
+	struct FGroup
+	{
+		// By packed handle without instance id
+		TMap<uint64, FComponentPtr> Components;
+	};
+	
+	using FGroupPtr = TSharedPtr<const FGroup, ESPMode::ThreadSafe>;
+	
+	uint64 GetVersion() const { return Version; }
+
+	bool IsRemoved(const FLBBiomesPackedInstanceHandle& Handle) const;
+	bool GetInstanceTransform(const FLBBiomesPackedInstanceHandle& Handle, FTransform& OutTransform) const;
+	const ULBBiomesInstanceUserData* GetUserData(const FLBBiomesPackedInstanceHandle& Handle) const;
+
+	static uint64 GetComponentKey(const FLBBiomesPackedInstanceHandle& Handle)
+	{
+		return Handle.Value >> FLBBiomesPackedInstanceHandle::InstanceBits;
+	}
+
+private:
+	friend class ULBBiomesInstanceController;
+	
+	const FComponent* FindComponent(const FLBBiomesPackedInstanceHandle& Handle) const;
+	
+	uint64 Version = 0;
+	TMap<int32, FGroupPtr> Groups;
+};
+
+using FLBBiomesInstanceSnapshotPtr = TSharedPtr<const FLBBiomesInstanceSnapshot, ESPMode::ThreadSafe>;
@@ -0,0 +1,72 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "Runtime/LBBiomesInstanceController.h"
+#include "LBBiomesPartitionStore.generated.h"
+
+/**
+ * Storage of removed instances of partitions which are not loaded.
+ * Each partition is kept as a separate chunk in the format of FLBBiomesPersistentInstancesData.
+ * Chunks are read and written on worker threads, one operation at a time per partition.
+ */
+UCLASS(Abstract)
+class PCGLAYEREDBIOMES_API ULBBiomesPartitionStore : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	// Return false if there is no chunk for the partition
+	virtual bool LoadChunk(const FLBBiomesPartition& Partition, TArray<uint8>& OutData) const PURE_VIRTUAL(ULBBiomesPartitionStore::LoadChunk, return false;);
+	virtual void SaveChunk(const FLBBiomesPartition& Partition, const TArray<uint8>& Data) PURE_VIRTUAL(ULBBiomesPartitionStore::SaveChunk,);
+	virtual void RemoveChunk(const FLBBiomesPartition& Partition) PURE_VIRTUAL(ULBBiomesPartitionStore::RemoveChunk,);
+	// Remove all chunks
+	virtual void Clear() PURE_VIRTUAL(ULBBiomesPartitionStore::Clear,);
+};
+
+/**
+ * Keeps chunks in separate files of a directory in Saved/SaveGames.
+ */
+UCLASS(BlueprintType)
+class PCGLAYEREDBIOMES_API ULBBiomesFilePartitionStore : public ULBBiomesPartitionStore
+{
+	GENERATED_BODY()
+
+public:
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	static ULBBiomesFilePartitionStore* CreateFilePartitionStore(UObject* Outer, const FString& DirectoryName);
+
+	virtual bool LoadChunk(const FLBBiomesPartition& Partition, TArray<uint8>& OutData) const override;
+	virtual void SaveChunk(const FLBBiomesPartition& Partition, const TArray<uint8>& Data) override;
+	virtual void RemoveChunk(const FLBBiomesPartition& Partition) override;
+	virtual void Clear() override;
+
+protected:
+	FString GetChunkPath(const FLBBiomesPartition& Partition) const;
+	
+	UPROPERTY()
+	FString Directory;
+};
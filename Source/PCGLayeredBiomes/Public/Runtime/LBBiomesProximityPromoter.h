@@ -0,0 +1,73 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LBBiomesPCGUtils.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LBBiomesProximityPromoter.generated.h"
+
+/**
+ * Promotes instances near player viewpoints to actors of ULBBiomesActorPool and demotes them when players go away.
+ * Demotion radius is greater than promotion one, so actors at the border don't flicker.
+ * Both are limited per frame and applied in batches per ISM component. See ULBBiomesRuntimeSettings for options.
+ */
+UCLASS()
+class PCGLAYEREDBIOMES_API ULBBiomesProximityPromoter : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	static ULBBiomesProximityPromoter* GetInstance(const UObject* WorldContext);
+	
+	/**
+	 * Stop or resume promotion. Actors promoted so far are demoted gradually after it's stopped.
+	 */
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	void SetEnabled(bool Value) { Enabled = Value; }
+	
+	UFUNCTION(BlueprintCallable, Category=Biomes)
+	bool IsEnabled() const { return Enabled; }
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	
+	void GetViewpoints(TArray<FVector>& OutViewpoints) const;
+	void DemoteFarActors(TConstArrayView<FVector> Viewpoints);
+	void PromoteNearInstances(TConstArrayView<FVector> Viewpoints);
+
+	static double GetDistanceSquared(const FVector& Location, TConstArrayView<FVector> Viewpoints);
+	
+	bool Enabled = false;
+	
+	// Instances promoted by this subsystem and their locations. Actors promoted by others are not touched
+	TMap<FLBBiomesPackedInstanceHandle, FVector> Promoted;
+};
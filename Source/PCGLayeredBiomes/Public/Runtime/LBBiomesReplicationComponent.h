@@ -0,0 +1,154 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "Net/Serialization/FastArraySerializer.h"
+#include "Runtime/LBBiomesInstanceController.h"
+#include "LBBiomesReplicationComponent.generated.h"
+
+class ULBBiomesReplicationComponent;
+
+/**
+ * Removed instance of a non-partitioned PCG component (Main is valid) or of a partition.
+ */
+USTRUCT()
+struct FLBBiomesReplicatedInstance : public FFastArraySerializerItem
+{
+	GENERATED_BODY()
+
+	void PostReplicatedAdd(const struct FLBBiomesReplicatedInstances& InArraySerializer);
+	void PreReplicatedRemove(const struct FLBBiomesReplicatedInstances& InArraySerializer);
+
+	UPROPERTY()
+	FGuid Main;
+	UPROPERTY()
+	FLBBiomesPartition Partition;
+	UPROPERTY()
+	FName ComponentName = NAME_None;
+	UPROPERTY()
+	int32 InstanceId = INDEX_NONE;
+	// Relative to the component, used to restore the instance on the client
+	UPROPERTY()
+	FTransform Transform;
+	// Transform is not known on the server, instance is replicated only as removed
+	UPROPERTY()
+	bool HasTransform = true;
+
+	// Handle on the server, not replicated
+	FLBBiomesPackedInstanceHandle Handle;
+};
+
+USTRUCT()
+struct FLBBiomesReplicatedInstances : public FFastArraySerializer
+{
+	GENERATED_BODY()
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+	{
+		return FastArrayDeltaSerialize<FLBBiomesReplicatedInstance, FLBBiomesReplicatedInstances>(Items, DeltaParms, *this);
+	}
+
+	void PostReplicatedReceive(const FFastArraySerializer::FPostReplicatedReceiveParameters& Parameters);
+	
+	UPROPERTY()
+	TArray<FLBBiomesReplicatedInstance> Items;
+
+	ULBBiomesReplicationComponent* Owner = nullptr;
+};
+
+template<>
+struct TStructOpsTypeTraits<FLBBiomesReplicatedInstances> : public TStructOpsTypeTraitsBase2<FLBBiomesReplicatedInstances>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
+
+/**
+ * Replicates removed instances of ULBBiomesInstanceController to the owning client. Should be added to PlayerController.
+ * Instances of non-partitioned PCG components are always sent, instances of a partition - after the client has loaded it.
+ * Only changes are sent after that. Removals and restores should be made on the server.
+ * All subscribed partitions share one fast array, so the server compares only items marked dirty, but unsubscribing
+ * a partition marks the whole array dirty, which rebuilds its item map once.
+ */
+UCLASS(ClassGroup=(Biomes), meta=(BlueprintSpawnableComponent))
+class PCGLAYEREDBIOMES_API ULBBiomesReplicationComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	ULBBiomesReplicationComponent();
+
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+protected:
+	friend FLBBiomesReplicatedInstance;
+	friend FLBBiomesReplicatedInstances;
+	
+	UFUNCTION(Server, Reliable)
+	void ServerSubscribe(const FLBBiomesPartition& Partition);
+	
+	UFUNCTION(Server, Reliable)
+	void ServerUnsubscribe(const FLBBiomesPartition& Partition);
+
+	// Server
+	void OnInstanceChanged(const FLBBiomesInstanceHandle& Handle, bool Removed, const FTransform* RemovedTransform);
+	void OnStateReset();
+	void AddGroup(int32 GroupId);
+	void AddItem(const FGuid& Main, const FLBBiomesPartition& Partition, const FLBBiomesInstanceHandle& Handle, const FTransform* Transform);
+	// Return true if the item was removed, the array has to be marked dirty then
+	bool RemoveItem(const FLBBiomesPackedInstanceHandle& Handle);
+	void RemovePartitionItems(const FLBBiomesPartition& Partition);
+
+	// Client
+	void OnPartitionLoadStateChanged(const FLBBiomesPartition& Partition, bool Loaded);
+	void QueueChange(const FLBBiomesReplicatedInstance& Item, bool Removed);
+	void ApplyChanges();
+	
+	ULBBiomesInstanceController* GetController() const;
+	
+	UPROPERTY(Replicated)
+	FLBBiomesReplicatedInstances Instances;
+
+	// Partitions loaded by the client
+	TSet<FLBBiomesPartition> Subscribed;
+	TMap<FLBBiomesPackedInstanceHandle, int32> ItemIndices;
+	// Items of subscribed partitions, so unsubscribing doesn't scan all of them
+	TMap<FLBBiomesPartition, TSet<FLBBiomesPackedInstanceHandle>> PartitionItems;
+
+	// Received in the current replication update, applied at once
+	FLBBiomesPersistentJournal ReceivedChanges;
+	// Subscribed partitions as known on the client
+	TSet<FLBBiomesPartition> LoadedPartitions;
+
+	FDelegateHandle InstanceChangedHandle;
+	FDelegateHandle StateResetHandle;
+	FDelegateHandle PartitionHandle;
+};
@@ -0,0 +1,159 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DeveloperSettings.h"
+#include "LBBiomesRuntimeSettings.generated.h"
+
+UENUM()
+enum class ELBBiomesPersistentTransforms : uint8
+{
+	// Transforms are not saved. They are taken from ISM when the state is applied to a loaded actor
+	None,
+	// Lossy, opt-in. Single precision location and scale, 16 bit rotation components.
+	// Restored instances might be slightly off their generated place
+	Quantized,
+	// Exact transforms
+	Full
+};
+
+/**
+ * Project settings of runtime part of the plugin.
+ */
+UCLASS(Config=Game, DefaultConfig, meta=(DisplayName="Layered Biomes Runtime"))
+class PCGLAYEREDBIOMES_API ULBBiomesRuntimeSettings : public UDeveloperSettings
+{
+	GENERATED_BODY()
+
+public:
+	ULBBiomesRuntimeSettings();
+
+	/**
+	 * Time per frame which can be spent on removing saved instances from loaded partitions.
+	 * Partitions nearest to the player are processed first.
+	 * Zero value removes all of them in the frame when a partition is loaded.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Partitions, meta=(ClampMin=0, ForceUnits="ms"))
+	float PartitionLoadBudgetMs = 1.f;
+
+	/**
+	 * Max count of instances removed from a component at once while loading a partition.
+	 * Budget is checked between such batches.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Partitions, meta=(ClampMin=1))
+	int32 PartitionLoadBatchSize = 512;
+
+	/**
+	 * Time per frame which can be spent on restoring regrown instances. The rest of due instances waits for the next frame.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Regrowth, meta=(ClampMin=0, ForceUnits="ms"))
+	float RegrowthBudgetMs = 0.5f;
+
+	/**
+	 * Max count of instances restored at once. Budget is checked between such batches.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Regrowth, meta=(ClampMin=1))
+	int32 RegrowthBatchSize = 256;
+
+	/**
+	 * Size of cells of spatial indices used by area queries.
+	 * Should be about the typical query radius.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Queries, meta=(ClampMin=100, ForceUnits="cm"))
+	float SpatialIndexCellSize = 5000.f;
+
+	/**
+	 * Keep spatial index of live instances of loaded partitions for FindInstancesInSphere and FindNearestInstances.
+	 * Index of a partition is built on the first query after it's loaded.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Queries)
+	bool IndexLiveInstances = false;
+
+	/**
+	 * Max count of demoted actors kept for reuse per UserData class. Extra actors are destroyed.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Actors, meta=(ClampMin=0))
+	int32 MaxPooledActors = 16;
+
+	/**
+	 * Replace instances which have actor class in UserData with actors near player viewpoints.
+	 * Requires IndexLiveInstances.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Actors)
+	bool AutoPromotion = false;
+
+	/**
+	 * Instances closer than this to any viewpoint are promoted.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Actors, meta=(ClampMin=0, ForceUnits="cm", EditCondition="AutoPromotion"))
+	float PromotionRadius = 1500.f;
+	
+	/**
+	 * Promoted actors farther than this from all viewpoints are demoted. Should be greater than PromotionRadius,
+	 * so actors at the border are not promoted and demoted back every frame.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Actors, meta=(ClampMin=0, ForceUnits="cm", EditCondition="AutoPromotion"))
+	float DemotionRadius = 2000.f;
+
+	/**
+	 * Max count of instances promoted per frame. Nearest ones go first.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Actors, meta=(ClampMin=1, EditCondition="AutoPromotion"))
+	int32 MaxPromotionsPerFrame = 8;
+
+	/**
+	 * Max count of actors demoted per frame. Farthest ones go first.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Actors, meta=(ClampMin=1, EditCondition="AutoPromotion"))
+	int32 MaxDemotionsPerFrame = 8;
+
+	/**
+	 * How transforms of removed instances are stored in FLBBiomesPersistentInstancesData.
+	 * Transforms are required to restore instances. Quantized makes saves smaller, but it's lossy.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Persistence)
+	ELBBiomesPersistentTransforms PersistentTransforms = ELBBiomesPersistentTransforms::Full;
+	
+	/**
+	 * Compress serialized FLBBiomesPersistentInstancesData with Oodle.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Persistence)
+	bool CompressPersistentData = true;
+
+	/**
+	 * Record removals and restores in the journal for incremental saves, see ULBBiomesInstanceController::GetJournalTail.
+	 * The journal keeps a copy of the data passed to SetPersistentData as its snapshot.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Persistence)
+	bool JournalChanges = false;
+
+	/**
+	 * Journal is compacted into the snapshot automatically when it has more entries than this.
+	 * Tails older than the compaction are not available after that, so the snapshot has to be saved.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category=Persistence, meta=(ClampMin=1, EditCondition="JournalChanges"))
+	int32 MaxJournalEntries = 65536;
+};
@@ -0,0 +1,141 @@
+﻿/*
+ * Copyright (c) 2024 LazyCatsDev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Uniform grid over XY plane for point queries. Keys are unique, adding existing key moves it.
+ * Cells are sparse, so the grid isn't bounded.
+ */
+template<typename KeyType>
+class TLBBiomesSpatialGrid
+{
+public:
+	explicit TLBBiomesSpatialGrid(double InCellSize = 5000.0)
+		: CellSize(FMath::Max(InCellSize, 1.0))
+	{
+	}
+
+	void Add(const KeyType& Key, const FVector& Location)
+	{
+		Remove(Key);
+		Locations.Add(Key, Location);
+		Cells.FindOrAdd(GetCell(Location)).Add(Key);
+	}
+
+	bool Remove(const KeyType& Key)
+	{
+		FVector Location;
+		if (!Locations.RemoveAndCopyValue(Key, Location))
+		{
+			return false;
+		}
+
+		const auto Cell = GetCell(Location);
+		auto& Keys = Cells.FindChecked(Cell);
+		Keys.RemoveSingleSwap(Key);
+		if (Keys.IsEmpty())
+		{
+			Cells.Remove(Cell);
+		}
+		return true;
+	}
+
+	void Reset(double InCellSize)
+	{
+		CellSize = FMath::Max(InCellSize, 1.0);
+		Cells.Reset();
+		Locations.Reset();
+	}
+
+	int32 Num() const { return Locations.Num(); }
+	const FVector* Find(const KeyType& Key) const { return Locations.Find(Key); }
+
+	void ForEachInBox(const FBox& Box, TFunctionRef<void(const KeyType&, const FVector&)> Callback) const
+	{
+		if (Locations.IsEmpty() || !Box.IsValid)
+		{
+			return;
+		}
+		
+		const auto Min = GetCell(Box.Min);
+		const auto Max = GetCell(Box.Max);
+		// Sparse grid might have less cells than the box covers
+		if (static_cast<int64>(Max.X - Min.X + 1) * (Max.Y - Min.Y + 1) > Cells.Num())
+		{
+			for (const auto& [Key, Location]: Locations)
+			{
+				if (Box.IsInsideOrOn(Location))
+				{
+					Callback(Key, Location);
+				}
+			}
+			return;
+		}
+		
+		for (int32 X = Min.X; X <= Max.X; ++X)
+		{
+			for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+			{
+				if (const auto* Keys = Cells.Find({X, Y}))
+				{
+					for (const auto& Key: *Keys)
+					{
+						const auto& Location = Locations.FindChecked(Key);
+						if (Box.IsInsideOrOn(Location))
+						{
+							Callback(Key, Location);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void ForEachInSphere(const FVector& Center, double Radius, TFunctionRef<void(const KeyType&, const FVector&)> Callback) const
+	{
+		const double RadiusSquared = FMath::Square(Radius);
+		ForEachInBox(FBox(Center - FVector(Radius), Center + FVector(Radius)), [&](const KeyType& Key, const FVector& Location)
+		{
+			if (FVector::DistSquared(Center, Location) <= RadiusSquared)
+			{
+				Callback(Key, Location);
+			}
+		});
+	}
+
+protected:
+	FIntPoint GetCell(const FVector& Location) const
+	{
+		return {
+			FMath::FloorToInt32(Location.X / CellSize),
+			FMath::FloorToInt32(Location.Y / CellSize)
+		};
+	}
+	
+	double CellSize;
+	TMap<FIntPoint, TArray<KeyType>> Cells;
+	TMap<KeyType, FVector> Locations;
+};